@@ -0,0 +1,39 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+// The fastest of runs calls of fn, in milliseconds.
+template <typename F>
+double best_of(int runs, F fn) {
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double, std::milli> took =
+            std::chrono::steady_clock::now() - start;
+        if (i == 0 || took.count() < best) best = took.count();
+    }
+    return best;
+}
+
+// An empty directory under TMPDIR, removed when the bench is done.
+class temp_dir {
+   public:
+    temp_dir() {
+        const char *tmp = std::getenv("TMPDIR");
+        path = std::string(tmp != nullptr ? tmp : "/tmp") + "/pm-bench-XXXXXX";
+        if (mkdtemp(path.data()) == nullptr) path.clear();
+    }
+    ~temp_dir() {
+        std::error_code error;
+        if (!path.empty()) std::filesystem::remove_all(path, error);
+    }
+    temp_dir(const temp_dir &) = delete;
+    temp_dir &operator=(const temp_dir &) = delete;
+
+    std::string path;
+};
+#endif
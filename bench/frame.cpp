@@ -0,0 +1,88 @@
+// Draws a project menu sized frame over and over, with one highlighted row
+// moving down the tree as it does while scrolling. Once the buffers and the
+// output have grown to size, a frame must not allocate.
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "ui_library.h"
+
+static const int WIDTH = 200;
+static const int HEIGHT = 50;
+static const int WARMUP = 50;
+static const int FRAMES = 2000;
+
+static size_t ALLOCATIONS = 0;
+
+void *operator new(size_t size) {
+    ALLOCATIONS++;
+    void *memory = malloc(size);
+    if (memory == nullptr) throw std::bad_alloc();
+    return memory;
+}
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
+int main() {
+    int middle = WIDTH / 2;
+    int left_width = WIDTH - middle - 1;
+    frame_buffer buffer(WIDTH, HEIGHT);
+    frame_buffer left(left_width, HEIGHT);
+    frame_buffer right(middle, HEIGHT);
+    std::vector<std::string> names;
+    for (int i = 0; i < HEIGHT; i++) {
+        names.push_back("src/some/path/file_" + std::to_string(i) + ".cpp");
+    }
+
+    auto frame = [&](int number) {
+        clear_buffer(buffer);
+        clear_buffer(left);
+        clear_buffer(right);
+        insert_colored(left, 1, 1, "Project Tree", "\033[7;1m");
+        insert_colored(left, 1, 2, "Navigate using the arrow keys.",
+                       "\033[3;36m");
+        draw_horizontal_line(left, 0, left_width, 3, '-');
+        for (int y = 4; y < HEIGHT - 1; y++) {
+            if (y == 4 + number % (HEIGHT - 5)) {
+                insert_colored(left, 1, y, names[y], "\033[7;3m");
+            } else {
+                insert_into_buffer(left, 1, y, names[y]);
+            }
+            insert_colored(right, 1, y, names[HEIGHT - 1 - y],
+                           y % 3 ? "\033[91m" : "\033[1;33m");
+        }
+        combine_buffers(buffer, left, right);
+        add_border(buffer);
+        draw_buffer(buffer);
+        flush_output();
+    };
+
+    // The frames go to /dev/null, the results to where stdout was.
+    int terminal = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (terminal < 0 || null < 0) return 1;
+    dup2(null, STDOUT_FILENO);
+    for (int i = 0; i < WARMUP; i++) frame(i);
+    size_t allocations = ALLOCATIONS;
+    render_stats before = get_render_stats();
+    double ms = best_of(1, [&] {
+        for (int i = 0; i < FRAMES; i++) frame(i);
+    });
+    allocations = ALLOCATIONS - allocations;
+    const render_stats &after = get_render_stats();
+    dup2(terminal, STDOUT_FILENO);
+
+    printf("frame, %dx%d, %d frames\n", WIDTH, HEIGHT, FRAMES);
+    printf("  %-24s %8.1f us\n", "time per frame", ms * 1000 / FRAMES);
+    printf("  %-24s %8zu\n", "bytes per frame",
+           (after.bytes - before.bytes) / FRAMES);
+    printf("  %-24s %8.2f\n", "allocations per frame",
+           static_cast<double>(allocations) / FRAMES);
+    return allocations == 0 ? 0 : 1;
+}
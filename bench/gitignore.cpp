@@ -0,0 +1,126 @@
+// Checks random paths against a large .gitignore, once with the compiled
+// matcher and once by trying every pattern with wildmatch, last to first.
+// Both have to agree.
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "gitignore.h"
+
+static const int RUNS = 5;
+static const int PATHS = 200000;
+
+static const char *const PATTERNS[] = {
+    "node_modules/", "dist/", "build/", "out/", ".next/", ".nuxt/", "coverage/",
+    ".nyc_output/", ".cache/", ".parcel-cache/", "*.log", "npm-debug.log*",
+    "yarn-debug.log*", "yarn-error.log*", "lerna-debug.log*",
+    ".pnpm-debug.log*", "*.tsbuildinfo", ".eslintcache", ".npm", ".yarn/cache",
+    ".env", ".env.local", ".env.*.local", "*.pid", "*.seed", "*.pid.lock",
+    "lib-cov", "bower_components", "jspm_packages/", "web_modules/",
+    "__pycache__/", "*.py[cod]", "*$py.class", "*.so", ".Python",
+    "develop-eggs/", "downloads/", "eggs/", ".eggs/", "/lib/", "lib64/",
+    "parts/", "sdist/", "var/", "wheels/", "*.egg-info/", ".installed.cfg",
+    "*.egg", "MANIFEST", "*.manifest", "*.spec", "pip-log.txt",
+    "pip-delete-this-directory.txt", "htmlcov/", ".tox/", ".nox/", ".coverage",
+    ".coverage.*", "nosetests.xml", "coverage.xml", "*.cover", "*.py,cover",
+    ".hypothesis/", ".pytest_cache/", "*.mo", "*.pot", "local_settings.py",
+    "db.sqlite3", "instance/", ".webassets-cache", ".scrapy", "docs/_build/",
+    "target/", ".ipynb_checkpoints", "profile_default/", "ipython_config.py",
+    ".python-version", "celerybeat-schedule", "*.sage.py", ".venv", "env/",
+    "venv/", "ENV/", ".spyderproject", ".ropeproject", "/site", ".mypy_cache/",
+    ".dmypy.json", ".pyre/", ".DS_Store", "Thumbs.db", "*.swp", "*~", "*.bak",
+    "*.tmp", "report.[0-9]*.[0-9]*.[0-9]*.[0-9]*.json", "!keep.log",
+    "**/generated/**", "docs/**/*.pdf",
+};
+
+static const char *const NAMES[] = {
+    "src", "lib", "index.js", "main.py", "util.c", "README.md", "foo.log",
+    "node_modules", "dist", "build", "a.pyc", "keep.log", "test_x.py",
+    "package.json", "x.egg-info", "report.1.2.3.4.json", "target", ".venv",
+    "Makefile", "generated", "docs", "paper.pdf",
+};
+
+struct sample {
+    std::string path;
+    bool is_dir;
+};
+
+// The matcher before patterns were compiled: every pattern is globbed.
+static bool linear_ignored(const ignore_list &list, const std::string &path,
+                           bool is_dir) {
+    size_t slash = path.rfind('/');
+    const char *basename =
+        path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+    for (auto it = list.patterns.rbegin(); it != list.patterns.rend(); it++) {
+        if (it->directory_only && !is_dir) continue;
+        const char *subject = it->anchored ? path.c_str() : basename;
+        if (wildmatch(it->glob.c_str(), subject)) return !it->negated;
+    }
+    return false;
+}
+
+int main() {
+    temp_dir root;
+    if (root.path.empty()) return 1;
+    std::string file = root.path + "/.gitignore";
+    FILE *out = fopen(file.c_str(), "w");
+    if (out == nullptr) return 1;
+    for (const char *pattern : PATTERNS) fprintf(out, "%s\n", pattern);
+    fclose(out);
+
+    gitignore compiled("", "");
+    compiled.push_directory(root.path, "");
+    ignore_list list;
+    read_ignore_file(file, list);
+
+    std::mt19937 random(1);
+    const size_t names = sizeof(NAMES) / sizeof(NAMES[0]);
+    std::vector<sample> samples;
+    for (int i = 0; i < PATHS; i++) {
+        std::string path;
+        int depth = 1 + random() % 4;
+        for (int d = 0; d < depth; d++) {
+            if (d > 0) path += '/';
+            path += NAMES[random() % names];
+            if (d < depth - 1 && random() % 3 == 0) {
+                path += std::to_string(random() % 10);
+            }
+        }
+        samples.push_back({path, random() % 3 == 0});
+    }
+
+    size_t differences = 0;
+    for (const sample &s : samples) {
+        if (compiled.ignored(s.path, s.is_dir) !=
+            linear_ignored(list, s.path, s.is_dir)) {
+            differences++;
+        }
+    }
+
+    size_t ignored = 0;
+    double linear = best_of(RUNS, [&] {
+        ignored = 0;
+        for (const sample &s : samples) {
+            ignored += linear_ignored(list, s.path, s.is_dir);
+        }
+    });
+    double fast = best_of(RUNS, [&] {
+        ignored = 0;
+        for (const sample &s : samples) {
+            ignored += compiled.ignored(s.path, s.is_dir);
+        }
+    });
+
+    printf("gitignore, %zu patterns, %d paths, %zu ignored, best of %d\n",
+           list.patterns.size(), PATHS, ignored, RUNS);
+    printf("  %-24s %8.1f ns per path\n", "every pattern globbed",
+           linear * 1e6 / PATHS);
+    printf("  %-24s %8.1f ns per path\n", "compiled", fast * 1e6 / PATHS);
+    if (differences > 0) {
+        printf("  %zu paths matched differently\n", differences);
+        return 1;
+    }
+    return 0;
+}
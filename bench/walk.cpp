@@ -0,0 +1,100 @@
+// Walks a tree with walk_tree and with std::filesystem. Without an argument
+// it builds a project with sources next to large ignored build directories,
+// otherwise it walks the given directory with gitignore off.
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "tree_walker.h"
+
+namespace fs = std::filesystem;
+
+static const int RUNS = 5;
+
+// What a tree of std::filesystem entries has to keep to match the node table.
+struct fs_node {
+    std::string name;
+    size_t parent;
+    bool is_dir;
+};
+
+static size_t walk_filesystem(const std::string &root) {
+    std::vector<fs_node> nodes;
+    // The node of the directory entered at each depth, the root is 0.
+    std::vector<size_t> parents = {0};
+    std::error_code error;
+    fs::recursive_directory_iterator it(
+        root, fs::directory_options::skip_permission_denied, error);
+    for (; !error && it != fs::recursive_directory_iterator();
+         it.increment(error)) {
+        size_t depth = it.depth();
+        if (parents.size() < depth + 2) parents.resize(depth + 2);
+        bool is_dir = it->is_directory(error) && !it->is_symlink(error);
+        nodes.push_back({it->path().filename(), parents[depth], is_dir});
+        if (is_dir) parents[depth + 1] = nodes.size();
+    }
+    return nodes.size();
+}
+
+static size_t walk_table(const std::string &root, bool gitignore) {
+    node_table table;
+    walk_options options;
+    options.gitignore = gitignore;
+    walk_tree(root, options, table);
+    return table.size() - 1;
+}
+
+static void add_files(const std::string &dir, int dirs, int files) {
+    mkdir(dir.c_str(), 0755);
+    for (int d = 0; d < dirs; d++) {
+        std::string sub = dir + "/dir" + std::to_string(d);
+        mkdir(sub.c_str(), 0755);
+        for (int f = 0; f < files; f++) {
+            std::string file = sub + "/file" + std::to_string(f) + ".o";
+            int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd >= 0) close(fd);
+        }
+    }
+}
+
+static void report(const char *label, size_t entries, double ms) {
+    printf("  %-24s %7zu entries %8.1f ms\n", label, entries, ms);
+}
+
+int main(int argc, char **argv) {
+    temp_dir project;
+    std::string root;
+    if (argc > 1) {
+        root = argv[1];
+    } else {
+        if (project.path.empty()) return 1;
+        root = project.path;
+        // A .git directory is all git_repository needs to find the ignores.
+        mkdir((root + "/.git").c_str(), 0755);
+        FILE *ignore = fopen((root + "/.gitignore").c_str(), "w");
+        if (ignore == nullptr) return 1;
+        fputs("target/\ndist/\n", ignore);
+        fclose(ignore);
+        add_files(root + "/src", 40, 100);
+        add_files(root + "/target", 200, 200);
+        add_files(root + "/dist", 50, 200);
+    }
+
+    size_t entries = 0;
+    printf("walk %s, best of %d\n", root.c_str(), RUNS);
+    double ms = best_of(RUNS, [&] { entries = walk_filesystem(root); });
+    report("std::filesystem", entries, ms);
+    ms = best_of(RUNS, [&] { entries = walk_table(root, false); });
+    report("walk_tree", entries, ms);
+    if (argc == 1) {
+        ms = best_of(RUNS, [&] { entries = walk_table(root, true); });
+        report("walk_tree, gitignore", entries, ms);
+    }
+    return 0;
+}
@@ -1,65 +1,131 @@
 #include "components.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <memory>
 
-std::string get_git_status(project &project) {
-    chdir(project.path.c_str());
-    std::string result = "";
-    FILE *pipe = popen("git status -bs", "r");
-    if (pipe) {
-        char buffer[128];
-        while (!feof(pipe)) {
-            if (fgets(buffer, 128, pipe) != nullptr) {
-                result += buffer;
-            }
-        }
+#include "fetch.h"
+#include "fuzzy.h"
+#include "git_status.h"
+#include "subprocess.h"
+#include "tree_walker.h"
+
+static int todo_count(const std::vector<int> &counts, int id) {
+    if (id < 0 || static_cast<size_t>(id) >= counts.size()) return 0;
+    return counts[id];
+}
+
+// Width of the git status column at the right of the main menu.
+static const size_t STATUS_WIDTH = 32;
+static const size_t BRANCH_WIDTH = 20;
+
+static std::string status_column(const git_summary &summary) {
+    if (!summary.valid) return "";
+    std::string branch = summary.branch;
+    if (branch.size() > BRANCH_WIDTH) {
+        branch = branch.substr(0, BRANCH_WIDTH - 1) + "~";
     }
-    return result;
+    std::string column = branch + std::string(BRANCH_WIDTH - branch.size(), ' ');
+    column += summary.dirty ? " * " : "   ";
+    if (summary.ahead > 0) column += "+" + std::to_string(summary.ahead) + " ";
+    if (summary.behind > 0) column += "-" + std::to_string(summary.behind);
+    return column.substr(0, STATUS_WIDTH);
 }
 
-void main_menu(sqlite3 *db, std::vector<std::string> &buffer,
-               std::vector<project> &projects, int screen_width,
-               int screen_height) {
+void main_menu(Database &db, frame_buffer &buffer,
+               project_model &model, int screen_width, int screen_height) {
+    std::vector<project> &projects = model.projects();
     int y = 0;
     char ch;
-    std::vector<int> projects_with_todo;
-    std::vector<styling> style_buffer;
-    for (size_t i = 0; i < projects.size(); i++) {
-        if (!get_todos(db, projects[i]).empty()) {
-            projects_with_todo.push_back(projects[i].id);
-        }
-    }
+    std::vector<int> todo_counts = get_todo_counts(db);
+    status_cache statuses(db.path());
+    tree_cache trees(tree_cache_budget_from_env());
+    bool request_all = true;
+
+    // Filtering with '/' shows the projects that match the query instead,
+    // best first, and y is a row of that list.
+    bool searching = false;
+    std::string query;
+    std::string searched;
+    bool finder_stale = true;
+    fuzzy_finder finder;
+    std::vector<uint32_t> matches;
+    auto row_count = [&]() {
+        return searching ? matches.size() : projects.size();
+    };
+    auto row = [&](size_t i) -> project & {
+        return searching ? projects[matches[i]] : projects[i];
+    };
 
     size_t start_scrolling = 5;
     size_t projects_start_index = 0;
     size_t projects_height = screen_height - 5;
-    std::string info =
-        "Use arrows to navigate the menu. Press ENTER to open a project, and "
-        "press \'q\' to quit.";
+    std::string menu_info =
+        "Use arrows to navigate the menu. Press ENTER to open a project, "
+        "\'/\' to filter them, \'s\' to search all todos and \'q\' to quit.";
+    std::string search_info =
+        "Type to filter, ENTER to open a project and ESC to stop filtering.";
     while (true) {
+        // Keep the cursor on the same project while the list changes around
+        // it.
+        const std::string selected =
+            static_cast<size_t>(y) < row_count() ? row(y).path : "";
+        bool changed = model.apply(db);
+        if (changed) {
+            finder_stale = true;
+            request_all = true;
+        }
+        if (searching && (finder_stale || query != searched)) {
+            if (finder_stale) {
+                finder.clear();
+                for (const auto &project : projects) {
+                    finder.add(project.name + " " + project.path);
+                }
+                finder_stale = false;
+            }
+            matches.clear();
+            for (const auto &match : finder.search(query, finder.size())) {
+                matches.push_back(match.index);
+            }
+            searched = query;
+            changed = true;
+        }
+        if (changed) {
+            for (size_t i = 0; i < row_count(); i++) {
+                if (row(i).path == selected) y = i;
+            }
+            if (static_cast<size_t>(y) >= row_count()) {
+                y = row_count() == 0 ? 0 : row_count() - 1;
+            }
+        }
+
         size_t info_offset = 0;
-        clear_screen();
-        int temp_width, temp_height;
-        get_console_size(temp_width, temp_height);
-        if (temp_width != screen_width || temp_height != screen_height) {
-            screen_width = temp_width;
-            screen_height = temp_height;
-            buffer = std::vector(screen_height, std::string(screen_width, ' '));
+        if (fit_to_screen(buffer, screen_width, screen_height)) {
             projects_height = screen_height - 5;
         } else {
-            clear_buffer(buffer, screen_width);
+            clear_buffer(buffer);
         }
-        style_buffer.clear();
 
         insert_into_buffer(buffer, 1, 1, "Projects:");
+        if (searching) {
+            std::string filter = "/" + query + "  " +
+                                 std::to_string(matches.size()) + "/" +
+                                 std::to_string(projects.size());
+            insert_colored(buffer, 11, 1, filter, "\033[1m");
+        } else if (model.scanning()) {
+            insert_colored(buffer, 11, 1,
+                           "scanning... " + std::to_string(model.found()) +
+                               " found",
+                           "\033[3;33m");
+        }
+        const std::string &info = searching ? search_info : menu_info;
         if (info.size() < static_cast<size_t>(screen_width) - 4) {
-            insert_colored(buffer, style_buffer, 1, 2, info, "\033[3;36m");
+            insert_colored(buffer, 1, 2, info, "\033[3;36m");
         } else {
             size_t pos = 0;
             while (info.size() > pos) {
                 std::string i = info.substr(pos, screen_width - 4);
-                insert_colored(buffer, style_buffer, 1, 2 + info_offset, i,
-                               "\033[3;36m");
+                insert_colored(buffer, 1, 2 + info_offset, i, "\033[3;36m");
                 pos += screen_width - 2;
                 info_offset++;
             }
@@ -67,49 +133,102 @@ void main_menu(sqlite3 *db, std::vector<std::string> &buffer,
         }
 
         draw_horizontal_line(buffer, 0, screen_width, 3 + info_offset, '-');
-        if (buffer.size() - projects_start_index >
-                projects_height - info_offset ||
-            projects_start_index > y - start_scrolling) {
-            if (static_cast<size_t>(y) > start_scrolling) {
-                projects_start_index = y - start_scrolling;
-            } else if (static_cast<size_t>(y) == start_scrolling) {
-                projects_start_index = 0;
+        // y can also jump up, when the filter changes or is left.
+        if (static_cast<size_t>(y) <= start_scrolling) {
+            projects_start_index = 0;
+        } else if (buffer.height() - projects_start_index >
+                       projects_height - info_offset ||
+                   projects_start_index > y - start_scrolling) {
+            projects_start_index = y - start_scrolling;
+        }
+
+        // Statuses of the rows on screen are computed first, the rest of
+        // the list follows in the background.
+        bool show_status = static_cast<size_t>(screen_width) > STATUS_WIDTH * 2;
+        size_t status_x = screen_width - STATUS_WIDTH - 2;
+        for (size_t i = projects_start_index;
+             show_status && i < row_count() &&
+             i <= projects_start_index + projects_height;
+             i++) {
+            statuses.request(row(i).path, true);
+        }
+        if (show_status && request_all) {
+            for (const auto &project : projects) {
+                statuses.request(project.path, false);
             }
+            request_all = false;
         }
 
-        for (size_t i = 0; i + projects_start_index < projects.size(); i++) {
-            if (i + projects_start_index > projects_height) break;
-            bool has_todo = false;
+        for (size_t i = 0; i + projects_start_index < row_count(); i++) {
+            // Rows below the header, which grows with a wrapped info line.
+            if (i + 5 + info_offset >= static_cast<size_t>(buffer.height())) {
+                break;
+            }
+            const project &project = row(i + projects_start_index);
             bool is_selected =
                 static_cast<size_t>(y) == i + projects_start_index;
-            for (size_t x = 0; x < projects_with_todo.size(); x++) {
-                if (projects_with_todo[x] ==
-                    projects[i + projects_start_index].id) {
-                    has_todo = true;
-                    break;
+            int count = todo_count(todo_counts, project.id);
+            bool has_todo = count > 0;
+            // While filtering the path is shown too, it is matched as well.
+            std::string name = project.name;
+            std::vector<int> positions;
+            if (searching) {
+                name += " " + project.path;
+                positions = finder.positions(
+                    matches[i + projects_start_index], query);
+            }
+            if (has_todo) name += " (" + std::to_string(count) + ")";
+            if (show_status && name.size() > status_x - 2) {
+                name = name.substr(0, status_x - 5) + "...";
+                while (!positions.empty() &&
+                       static_cast<size_t>(positions.back()) >= status_x - 5) {
+                    positions.pop_back();
                 }
             }
-            const std::string name = projects[i + projects_start_index].name;
-            if (has_todo && is_selected) {
-                insert_colored(buffer, style_buffer, 1, i + 4 + info_offset,
-                               name, "\033[91;7;3m");
+            if (searching) {
+                std::string colors = has_todo ? "\033[91m" : "";
+                if (is_selected) colors += "\033[7;3m";
+                insert_highlighted(buffer, 1, i + 4 + info_offset, name,
+                                   positions, colors,
+                                   is_selected ? "\033[7;1;33m" : "\033[1;33m");
+            } else if (has_todo && is_selected) {
+                insert_colored(buffer, 1, i + 4 + info_offset, name,
+                               "\033[91;7;3m");
             } else if (has_todo) {
-                insert_colored(buffer, style_buffer, 1, i + 4 + info_offset,
-                               name, "\033[91m");
+                insert_colored(buffer, 1, i + 4 + info_offset, name,
+                               "\033[91m");
             } else if (is_selected) {
-                insert_colored(buffer, style_buffer, 1, i + 4 + info_offset,
-                               name, "\033[7;3m");
+                insert_colored(buffer, 1, i + 4 + info_offset, name,
+                               "\033[7;3m");
 
             } else {
                 insert_into_buffer(buffer, 1, i + 4 + info_offset, name);
             }
+
+            if (!show_status) continue;
+            git_summary summary;
+            if (!statuses.get(project.path, summary)) {
+                insert_colored(buffer, status_x, i + 4 + info_offset, "...",
+                               "\033[2m");
+            } else if (summary.valid) {
+                insert_colored(buffer, status_x, i + 4 + info_offset,
+                               status_column(summary),
+                               summary.dirty ? "\033[33m" : "\033[32m");
+            }
         }
-        add_border(buffer, screen_width);
-        draw_buffer(buffer, style_buffer);
+        add_border(buffer);
+        draw_buffer(buffer);
         if (!wait_for_input()) continue;
 
         ch = getchar();
         if (ch == 27) {
+            if (!kbhit()) {
+                // ESC on its own leaves the filter, on the same project.
+                if (!searching) continue;
+                if (static_cast<size_t>(y) < matches.size()) y = matches[y];
+                searching = false;
+                continue;
+            }
             ch = getchar();
             if (ch != 91) {
                 continue;
@@ -122,71 +241,115 @@ void main_menu(sqlite3 *db, std::vector<std::string> &buffer,
                     y--;
                     break;
                 case 66:  // DOWN ARROW
-                    if (static_cast<size_t>(y) == projects.size() - 1) break;
+                    if (static_cast<size_t>(y) + 1 >= row_count()) break;
                     y++;
                     break;
             }
+        } else if (searching && ch == 127) {
+            if (!query.empty()) query.pop_back();
+        } else if (searching && ch >= ' ' && ch <= '~') {
+            query += ch;
+        } else if (ch == '/') {
+            searching = true;
+            query.clear();
+            matches.clear();
+            searched = "/";  // never a query, so the list is built
+            y = 0;
         } else if (ch == 'q') {
             y = -1;
             break;
         } else if (ch == '\n') {
-            project_menu(db, buffer, screen_width, screen_height, projects[y]);
-            projects_with_todo.clear();
+            if (row_count() == 0) continue;
+            project_menu(db, statuses, trees, buffer, screen_width,
+                         screen_height, row(y));
+            todo_counts = get_todo_counts(db);
+            statuses.revalidate(row(y).path);
+            trees.trim();
+        } else if (ch == 's') {
+            todo_match match;
+            if (!search_popup(db, buffer, screen_width, match)) continue;
+            searching = false;
             for (size_t i = 0; i < projects.size(); i++) {
-                if (!get_todos(db, projects[i]).empty()) {
-                    projects_with_todo.push_back(projects[i].id);
-                }
+                if (projects[i].id != match.item.project_id) continue;
+                y = i;
+                project_menu(db, statuses, trees, buffer, screen_width,
+                             screen_height, projects[y], match.item.id);
+                todo_counts = get_todo_counts(db);
+                statuses.revalidate(projects[y].path);
+                trees.trim();
+                break;
             }
         } else if (ch == 'f') {
-            popup(buffer, "Fetching all projects", screen_width);
-            clear_screen();
-            draw_buffer(buffer, {});
+            fetch_popup(buffer, screen_width, projects);
+            statuses.invalidate_all();
+        }
+    }
+}
 
-            for (size_t i = 0; i < projects.size(); i++) {
-                std::string info = "Fetching: (" + std::to_string(i) + "/" +
-                                   std::to_string(projects.size()) + ")";
-                popup(buffer, info, screen_width, false);
-                chdir(projects[i].path.c_str());
-                system("git fetch");
-            }
+static void open_in_editor(status_cache &statuses, const project &project,
+                           const std::string &path) {
+    process_options nvim;
+    nvim.argv = {"nvim", path};
+    nvim.directory = project.path;
+    nvim.capture = false;
+    enable_cursor();
+    flush_output();
+    run_process(nvim);
+    disable_cursor();
+    // Whatever the editor left on screen is replaced.
+    clear_screen();
+    statuses.invalidate(project.path);
+}
 
-            popup(buffer, "Done fetching all projects", screen_width);
-        }
+// Every file of the project that git does not ignore, relative to its root.
+static void add_project_files(fuzzy_finder &files, const std::string &root) {
+    node_table table;
+    walk_tree(root, walk_options(), table);
+    // Parents always come before their children, so the paths of the
+    // directories are built on the way down.
+    std::vector<std::string> paths(table.size());
+    for (uint32_t node = 1; node < table.size(); node++) {
+        uint32_t parent = table.parent(node);
+        paths[node] = parent == 0 ? table.name(node)
+                                  : paths[parent] + "/" + table.name(node);
+        if (!table.is_dir(node)) files.add(paths[node]);
     }
 }
 
-void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
-                  int screen_width, int screen_height, project &project) {
+void project_menu(Database &db, status_cache &statuses, tree_cache &trees,
+                  frame_buffer &buffer, int screen_width,
+                  int screen_height, project &project, int focus_todo) {
     int middle = screen_width / 2;
     size_t left_offset = screen_width - middle - middle;
     size_t left_width = middle + left_offset - 1;
-    std::vector<std::string> left_buffer(screen_height,
-                                         std::string(left_width, ' '));
-    std::vector<std::string> right_buffer(screen_height,
-                                          std::string(middle, ' '));
-    std::vector<styling> left_style_buffer;
-    std::vector<styling> right_style_buffer;
-
-    std::string git_status = get_git_status(project);
-    std::vector<std::string> git_status_lines;
+    frame_buffer left_buffer(left_width, screen_height);
+    frame_buffer right_buffer(middle, screen_height);
 
-    size_t p = 0;
-    std::string delimiter = "\n";
-    std::string token;
-    while ((p = git_status.find(delimiter)) != std::string::npos) {
-        token = git_status.substr(0, p);
-        git_status_lines.push_back(token);
-        git_status.erase(0, p + delimiter.length());
-    }
+    // Shown from the cache right away, updated once the background check is
+    // done.
+    std::string git_status;
+    bool has_git_status = false;
+    std::vector<std::string> git_status_lines;
 
     project.id = get_project_id(db, project);
-    std::vector<todo> todos = get_todos(db, project);
+    todo_model todos(db, project.id);
+    statuses.refresh(project.path);
 
-    const std::vector<fs::path> tree = file_tree(project.path);
+    std::shared_ptr<file_tree> cached = trees.open(project.id, project.path);
+    file_tree &tree = *cached;
+    // Read when the finder is first opened.
+    std::unique_ptr<fuzzy_finder> files;
     char ch;
     int x = 0;
     int left_y = -1;
     int right_y = 0;
+    if (focus_todo >= 0) {
+        int index = todos.index_of(focus_todo);
+        if (index >= 0) {
+            x = 1;
+            right_y = index;
+        }
+    }
     int tree_offset = 5;
     int info_offset = 0;
     int tree_starting_index = 0;
@@ -195,45 +358,38 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
     int start_scrolling = todo_height - 1 < 5 ? todo_height - 2 : 5;
     std::string left_info =
         "Navigate using the arrow keys. Press ENTER over a file you wish "
-        "to edit, and \'q\' to quit.";
+        "to edit or a directory to open it, LEFT to close it, \'f\' to find "
+        "a file and \'q\' to quit.";
     std::string right_info =
         "When focusing this section press \'a\' to add a todo entry and "
         "ENTER to remove an entry.";
     while (true) {
+        tree.apply(left_y);
         info_offset = 0;
-        int temp_width, temp_height;
-        get_console_size(temp_width, temp_height);
-        if (temp_width != screen_width || temp_height != screen_height) {
-            screen_width = temp_width;
-            screen_height = temp_height;
+        if (fit_to_screen(buffer, screen_width, screen_height)) {
             todo_height = screen_height - 4 - 9;
             middle = screen_width / 2;
             left_offset = screen_width - middle - middle;
             left_width = middle + left_offset - 1;
-            left_buffer =
-                std::vector(screen_height, std::string(left_width, ' '));
-            right_buffer = std::vector(screen_height, std::string(middle, ' '));
-            buffer = std::vector(screen_height, std::string(screen_width, ' '));
+            left_buffer.resize(left_width, screen_height);
+            right_buffer.resize(middle, screen_height);
         } else {
-            clear_buffer(buffer, screen_width);
-            clear_buffer(left_buffer, left_width);
-            clear_buffer(right_buffer, middle);
+            clear_buffer(buffer);
+            clear_buffer(left_buffer);
+            clear_buffer(right_buffer);
         }
-        left_style_buffer.clear();
-        right_style_buffer.clear();
 
         // LEFT BUFFER
-        insert_colored(left_buffer, left_style_buffer, 1, 1, "Project Tree",
+        insert_colored(left_buffer, 1, 1, "Project Tree",
                        x == 0 ? "\033[7;1m" : "\033[1m");
         if (left_info.length() < left_width - 1) {
-            insert_colored(left_buffer, left_style_buffer, 1, 2, left_info,
-                           "\033[3;36m");
+            insert_colored(left_buffer, 1, 2, left_info, "\033[3;36m");
         } else {
             size_t pos = 0;
             while (left_info.size() > pos) {
                 std::string info = left_info.substr(pos, left_width - 1);
-                insert_colored(left_buffer, left_style_buffer, 1,
-                               2 + info_offset, info, "\033[3;36m");
+                insert_colored(left_buffer, 1, 2 + info_offset, info,
+                               "\033[3;36m");
                 pos += left_width - 1;
                 info_offset++;
             }
@@ -241,7 +397,7 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
         }
         draw_horizontal_line(left_buffer, 0, left_width, 3 + info_offset, '-');
 
-        if (buffer.size() - tree_starting_index >
+        if (static_cast<size_t>(buffer.height()) - tree_starting_index >
                 static_cast<size_t>(screen_height - tree_offset - info_offset -
                                     1) ||
             tree_starting_index > left_y - start_scrolling) {
@@ -252,27 +408,24 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
             }
         }
 
-        insert_colored(left_buffer, left_style_buffer, 1, 4 + info_offset,
-                       project.name,
+        insert_colored(left_buffer, 1, 4 + info_offset, project.name,
                        left_y == -1 && x == 0 ? "\033[7;91m" : "\033[91m");
-        add_tree_to_buffer(left_buffer, left_style_buffer, tree, 1,
-                           tree_offset + info_offset, project.path.length(),
+        add_tree_to_buffer(left_buffer, tree, 1, tree_offset + info_offset,
                            x == 0 ? left_y : -1, tree_starting_index);
 
         // RIGHT BUFFER
         info_offset = 0;
-        insert_colored(right_buffer, right_style_buffer, 1, 1, "Todo List",
+        insert_colored(right_buffer, 1, 1, "Todo List",
                        x == 1 ? "\033[7;1m" : "\033[1m");
         size_t max_info_width = middle - 1;
         if (right_info.size() < max_info_width) {
-            insert_colored(right_buffer, right_style_buffer, 1, 2, right_info,
-                           "\033[3;36m");
+            insert_colored(right_buffer, 1, 2, right_info, "\033[3;36m");
         } else {
             size_t pos = 0;
             while (right_info.size() > pos) {
                 std::string info = right_info.substr(pos, max_info_width - 1);
-                insert_colored(right_buffer, right_style_buffer, 1,
-                               2 + info_offset, info, "\033[3;36m");
+                insert_colored(right_buffer, 1, 2 + info_offset, info,
+                               "\033[3;36m");
                 pos += max_info_width - 1;
                 info_offset++;
             }
@@ -281,7 +434,8 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
 
         draw_horizontal_line(right_buffer, 0, middle, 3 + info_offset, '-');
 
-        if (buffer.size() - todo_starting_index > todo_height ||
+        if (static_cast<size_t>(buffer.height()) - todo_starting_index >
+                todo_height ||
             todo_starting_index > right_y - start_scrolling) {
             if (right_y > start_scrolling) {
                 todo_starting_index = right_y - start_scrolling;
@@ -290,22 +444,20 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
             }
         }
 
+        todos.load(todo_starting_index, todo_height);
         for (size_t i = 0;
              i + todo_starting_index < todos.size() && i < todo_height; i++) {
+            const std::string &task = todos.at(i + todo_starting_index).task;
             std::string todo_string;
-            if (todos[i + todo_starting_index].task.size() >=
-                static_cast<size_t>(middle - 2)) {
-                todo_string =
-                    todos[i + todo_starting_index].task.substr(0, middle - 5) +
-                    "...";
+            if (task.size() >= static_cast<size_t>(middle - 2)) {
+                todo_string = task.substr(0, middle - 5) + "...";
             } else {
-                todo_string = todos[i + todo_starting_index].task;
+                todo_string = task;
             }
 
             if (i + todo_starting_index == static_cast<size_t>(right_y)) {
-                insert_colored(right_buffer, right_style_buffer, 1,
-                               4 + info_offset + i, todo_string,
-                               x == 1 ? "\033[7;3m" : "");
+                insert_colored(right_buffer, 1, 4 + info_offset + i,
+                               todo_string, x == 1 ? "\033[7;3m" : "");
             } else {
                 insert_into_buffer(right_buffer, 1, 4 + info_offset + i,
                                    todo_string);
@@ -313,10 +465,28 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
         }
 
         // GIT STATUS
-        insert_colored(right_buffer, right_style_buffer, 1, screen_height - 10,
-                       "Git status", "\033[1m");
+        insert_colored(right_buffer, 1, screen_height - 10, "Git status",
+                       "\033[1m");
         draw_horizontal_line(right_buffer, 1, middle, screen_height - 9, '-');
 
+        statuses.request(project.path, true);
+        std::string latest;
+        if (statuses.get_status(project.path, latest) &&
+            (!has_git_status || latest != git_status)) {
+            has_git_status = true;
+            git_status = latest;
+            git_status_lines.clear();
+            size_t start = 0, end;
+            while ((end = latest.find('\n', start)) != std::string::npos) {
+                git_status_lines.push_back(latest.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+        if (!has_git_status) {
+            insert_colored(right_buffer, 1, screen_height - 8, "...",
+                           "\033[2m");
+        }
+
         for (size_t i = 0; i < git_status_lines.size(); i++) {
             if (i == 6 && git_status_lines.size() > i) {
                 insert_into_buffer(right_buffer, 1, screen_height - 8 + i,
@@ -327,14 +497,12 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
                                git_status_lines[i]);
         }
 
-        std::vector<styling> style_buffer =
-            combine_buffers(buffer, left_buffer, left_style_buffer,
-                            right_buffer, right_style_buffer, left_width);
-        add_border(buffer, screen_width);
+        combine_buffers(buffer, left_buffer, right_buffer);
+        add_border(buffer);
 
-        draw_buffer(buffer, style_buffer);
+        draw_buffer(buffer);
 
-        if (!wait_for_input()) continue;
+        if (!wait_for_input(tree.watch_fd())) continue;
 
         ch = getchar();
         if (ch == 27) {
@@ -361,88 +529,94 @@ void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
                         left_y++;
                         break;
                     }  // else right button movement
-                    if (static_cast<size_t>(right_y) == todos.size() - 1) break;
+                    if (static_cast<size_t>(right_y) + 1 >= todos.size())
+                        break;
                     right_y++;
                     break;
                 case 67:  // RIGHT ARROW
                     x = 1;
                     break;
                 case 68:  // LEFT ARROW
-                    x = 0;
+                    if (x == 1) {
+                        x = 0;
+                    } else if (left_y >= 0) {
+                        if (tree.at(left_y).expanded) {
+                            tree.collapse(left_y);
+                        } else {
+                            left_y = tree.parent_row(left_y);
+                        }
+                    }
                     break;
             }
         } else if (ch == 'q') {
             left_y = -1;
             break;
         } else if (ch == '\n') {
-            if (x == 0) {  // left buffer submit
-                std::string cmd = "nvim ";
-                if (left_y == -1) {
-                    cmd += project.path;
+            if (x == 0 && left_y >= 0 && tree.at(left_y).is_dir) {
+                if (tree.at(left_y).expanded) {
+                    tree.collapse(left_y);
                 } else {
-                    cmd += tree[left_y];
+                    tree.expand(left_y);
                 }
-                enable_cursor();
-                system(cmd.c_str());
-                disable_cursor();
+            } else if (x == 0) {  // left buffer submit
+                open_in_editor(statuses, project,
+                               left_y == -1 ? project.path : tree.path(left_y));
+                files.reset();
             } else {  // right buffer submit
                 if (todos.size() == 0) continue;
 
-                if (choice_popup(buffer, todos[right_y].task, "Delete",
+                if (choice_popup(buffer, todos.at(right_y).task, "Delete",
                                  "Cancel", screen_width) == 0) {
                     if (choice_popup(buffer, "Are you sure?", "Yes", "No",
                                      screen_width) == 0) {
-                        remove_todo(db, todos[right_y]);
-                        todos = get_todos(db, project);
+                        todos.remove(right_y);
                         if (right_y != 0) right_y--;
                     }
                 }
             }
+        } else if (ch == 'f') {
+            if (!files) {
+                files = std::make_unique<fuzzy_finder>();
+                add_project_files(*files, project.path);
+            }
+            std::string path;
+            if (!find_file_popup(buffer, screen_width, *files, path)) continue;
+            open_in_editor(statuses, project, project.path + "/" + path);
+            files.reset();
         } else if (ch == 'a' && x == 1) {
             std::string input =
                 input_popup(buffer, "Enter a task:", screen_width);
             if (input == "") continue;
-            add_todo(db, project, input);
-            todos = get_todos(db, project);
+            todos.add(input);
         } else if (ch == 'c') {
             exit_program(db, project.path, 0);
         }
     }
 }
 
-void popup(std::vector<std::string> &buffer, const std::string message,
+void popup(frame_buffer &buffer, const std::string message,
            int screen_width, bool has_ok) {
     int width = 32;
     int height = 7;
 
-    std::vector<std::string> center_buffer(height, std::string(width, ' '));
-    std::vector<styling> style_buffer = {};
+    frame_buffer center_buffer(width, height);
     int start_x = (screen_width / 2) - (width / 2);
-    int start_y = (buffer.size() / 2) - (height / 2);
+    int start_y = (buffer.height() / 2) - (height / 2);
 
     int middle = width / 2;
     int message_pos = middle - (message.size() / 2);
 
-    insert_colored(center_buffer, style_buffer, message_pos, 2, message,
-                   "\033[1;38;5;99m");
+    insert_colored(center_buffer, message_pos, 2, message, "\033[1;38;5;99m");
     if (has_ok) {
-        insert_colored(center_buffer, style_buffer, middle - 1, 4, "Ok",
-                       "\033[7;3m");
+        insert_colored(center_buffer, middle - 1, 4, "Ok", "\033[7;3m");
     }
 
-    add_border(center_buffer, width);
+    add_border(center_buffer);
 
-    for (int y = 0; y < height; y++) {
-        insert_into_buffer(buffer, start_x, start_y + y, center_buffer[y]);
-    }
+    insert_buffer(buffer, start_x, start_y, center_buffer);
 
-    for (auto &style : style_buffer) {
-        style.x += start_x;
-        style.y += start_y;
-    }
-
-    clear_screen();
-    draw_buffer(buffer, style_buffer);
+    draw_buffer(buffer);
+    flush_output();
 
     if (has_ok) {
         char ch;
@@ -453,15 +627,14 @@ void popup(std::vector<std::string> &buffer, const std::string message,
     }
 }
 
-int choice_popup(std::vector<std::string> &buffer, const std::string message,
+int choice_popup(frame_buffer &buffer, const std::string message,
                  const std::string left, const std::string right,
                  int screen_width) {
     int width = 48;
     int height = 9;
-    std::vector<std::string> center_buffer(height, std::string(width, ' '));
-    std::vector<styling> style_buffer;
+    frame_buffer center_buffer(width, height);
     int start_x = (screen_width / 2) - (width / 2);
-    int start_y = (buffer.size() / 2) - (height / 2);
+    int start_y = (buffer.height() / 2) - (height / 2);
 
     char ch;
     int choice = 0;
@@ -472,22 +645,18 @@ int choice_popup(std::vector<std::string> &buffer, const std::string message,
     int right_pos = middle + hh_width - (right.size() / 2);
     int task_padding = 16;
     size_t max_width_task = width - task_padding;
+    int screen_height = buffer.height();
     while (true) {
-        int temp_width, temp_height;
-        get_console_size(temp_width, temp_height);
-        if (temp_width != screen_width) {
-            screen_width = temp_width;
-            buffer = std::vector(temp_height, std::string(screen_width, ' '));
+        if (fit_to_screen(buffer, screen_width, screen_height)) {
             start_x = (screen_width / 2) - (width / 2);
-            start_y = (buffer.size() / 2) - (height / 2);
+            start_y = (buffer.height() / 2) - (height / 2);
         }
-        clear_buffer(center_buffer, width);
-        style_buffer.clear();
+        clear_buffer(center_buffer);
 
         size_t size = message.size();
         if (size < max_width_task) {
             int message_pos = middle - (size / 2);
-            insert_colored(center_buffer, style_buffer, message_pos, 2, message,
+            insert_colored(center_buffer, message_pos, 2, message,
                            "\033[1;38;5;99m");
         } else {
             size_t pos = 0;
@@ -496,8 +665,8 @@ int choice_popup(std::vector<std::string> &buffer, const std::string message,
             while (size > pos) {
                 std::string info = task.substr(pos, max_width_task);
                 int message_pos = middle - (info.size() / 2);
-                insert_colored(center_buffer, style_buffer, message_pos,
-                               2 + task_offset, info, "\033[1;38;5;99m");
+                insert_colored(center_buffer, message_pos, 2 + task_offset,
+                               info, "\033[1;38;5;99m");
                 pos += max_width_task;
                 task_offset++;
             }
@@ -506,23 +675,15 @@ int choice_popup(std::vector<std::string> &buffer, const std::string message,
 
         draw_horizontal_line(center_buffer, 0, width, 4, '-');
 
-        insert_colored(center_buffer, style_buffer, left_pos, 6, left,
+        insert_colored(center_buffer, left_pos, 6, left,
                        choice == 0 ? "\033[7;3m" : "");
-        insert_colored(center_buffer, style_buffer, right_pos, 6, right,
+        insert_colored(center_buffer, right_pos, 6, right,
                        choice == 1 ? "\033[7;3m" : "");
 
-        add_border(center_buffer, width);
-        for (int y = 0; y < height; y++) {
-            insert_into_buffer(buffer, start_x, start_y + y, center_buffer[y]);
-        }
-
-        for (auto &style : style_buffer) {
-            style.x += start_x;
-            style.y += start_y;
-        }
+        add_border(center_buffer);
+        insert_buffer(buffer, start_x, start_y, center_buffer);
 
-        clear_screen();
-        draw_buffer(buffer, style_buffer);
+        draw_buffer(buffer);
 
         if (!wait_for_input()) continue;
 
@@ -549,42 +710,380 @@ int choice_popup(std::vector<std::string> &buffer, const std::string message,
     return choice;
 }
 
-std::string input_popup(std::vector<std::string> &buffer,
+// The line of git's output that says why a fetch failed, its first fatal
+// error or else the last line it wrote.
+static std::string fetch_error(const fetch_result &result) {
+    if (result.timed_out) return "timed out";
+    const std::string &output = result.output;
+    size_t start = output.find("fatal: ");
+    if (start != std::string::npos) {
+        return output.substr(start + 7, output.find('\n', start) - start - 7);
+    }
+    size_t end = output.find_last_not_of("\n ");
+    if (end == std::string::npos) {
+        return "exit code " + std::to_string(result.exit_code);
+    }
+    start = output.rfind('\n', end);
+    start = start == std::string::npos ? 0 : start + 1;
+    return output.substr(start, end - start + 1);
+}
+
+void fetch_popup(frame_buffer &buffer, int screen_width,
+                 const std::vector<project> &projects) {
+    std::vector<std::string> paths;
+    for (const auto &project : projects) {
+        paths.push_back(project.path);
+    }
+    fetch_scheduler scheduler(paths, fetch_options_from_env());
+    scheduler.start();
+
+    int width = std::min(screen_width - 4, 72);
+    int height = 9;
+    int middle = width / 2;
+    frame_buffer center_buffer;
+    std::string message = "Fetching all projects";
+    std::string info = "Press ESC to cancel.";
+    bool cancelled = false;
+    bool summarized = false;
+    std::vector<std::string> failures;
+    char ch;
+    int screen_height = buffer.height();
+    while (true) {
+        bool finished = scheduler.finished();
+        if (finished && !summarized) {
+            summarized = true;
+            for (const auto &result : scheduler.results()) {
+                if (result.ok || result.cancelled) continue;
+                std::string name = result.path;
+                for (const auto &project : projects) {
+                    if (project.path == result.path) name = project.name;
+                }
+                failures.push_back(name + ": " + fetch_error(result));
+            }
+            message = cancelled ? "Fetching cancelled" : "Done fetching";
+            info = "";
+            int max_height = buffer.height() - 2;
+            height = std::min(max_height, 9 + static_cast<int>(failures.size()));
+        }
+
+        fit_to_screen(buffer, screen_width, screen_height);
+        int start_x = (screen_width / 2) - (width / 2);
+        int start_y = (buffer.height() / 2) - (height / 2);
+        center_buffer.resize(width, height);
+
+        std::string counts = "Running: " + std::to_string(scheduler.running()) +
+                             "  Done: " + std::to_string(scheduler.done()) +
+                             "/" + std::to_string(scheduler.total()) +
+                             "  Failed: " + std::to_string(scheduler.failed());
+        insert_colored(center_buffer, middle - (message.size() / 2), 1, message,
+                       "\033[1;38;5;99m");
+        insert_into_buffer(center_buffer, middle - (counts.size() / 2), 3,
+                           counts);
+        if (!info.empty()) {
+            insert_colored(center_buffer, middle - (info.size() / 2), 5, info,
+                           "\033[3;36m");
+        }
+        for (size_t i = 0;
+             i < failures.size() && 5 + i < static_cast<size_t>(height - 3);
+             i++) {
+            std::string line = failures[i];
+            if (line.size() > static_cast<size_t>(width - 4)) {
+                line = line.substr(0, width - 7) + "...";
+            }
+            insert_colored(center_buffer, 2, 5 + i, line, "\033[31m");
+        }
+        if (finished) {
+            insert_colored(center_buffer, middle - 1, height - 2, "Ok",
+                           "\033[7;3m");
+        }
+
+        add_border(center_buffer);
+        insert_buffer(buffer, start_x, start_y, center_buffer);
+
+        draw_buffer(buffer);
+
+        if (!wait_for_input()) continue;
+        ch = getchar();
+        if (finished) {
+            if (ch == '\n') break;
+        } else if (ch == 27 && !kbhit()) {
+            cancelled = true;
+            scheduler.cancel();
+        }
+    }
+    clear_buffer(buffer);
+}
+
+// Searches the todos of every project while typing. Returns false when the
+// search is left with ESC.
+bool search_popup(Database &db, frame_buffer &buffer,
+                  int screen_width, todo_match &match) {
+    enable_cursor();
+    int width = std::min(screen_width - 4, 72);
+    int height = std::min(buffer.height() - 2, 20);
+    frame_buffer center_buffer(width, height);
+    int start_x = (screen_width / 2) - (width / 2);
+    int start_y = (buffer.height() / 2) - (height / 2);
+
+    char ch;
+    std::string input_buffer;
+    std::string searched;
+    std::vector<todo_match> results;
+    int selected = 0;
+    int input_width = width - 4;
+    frame_buffer input_box(input_width, 3);
+
+    std::string message = "Search todos:";
+    std::string info = "Use arrows to select, ENTER to open, ESC to quit.";
+    int middle = width / 2;
+    int results_y = 7;
+    int screen_height = buffer.height();
+    while (true) {
+        if (fit_to_screen(buffer, screen_width, screen_height)) {
+            start_x = (screen_width / 2) - (width / 2);
+            start_y = (buffer.height() / 2) - (height / 2);
+        }
+
+        if (input_buffer != searched) {
+            // A short terminal leaves no room for results, there is nothing
+            // to look up.
+            int rows = height - results_y - 1;
+            results.clear();
+            if (rows > 0) results = search_todos(db, input_buffer, rows);
+            searched = input_buffer;
+            selected = 0;
+        }
+
+        clear_buffer(center_buffer);
+        clear_buffer(input_box);
+
+        insert_colored(center_buffer, middle - (message.size() / 2), 1, message,
+                       "\033[1;38;5;99m");
+        insert_colored(center_buffer, middle - (info.size() / 2), 2, info,
+                       "\033[3;36m");
+
+        size_t visible = input_width - 2;
+        std::string shown = input_buffer.size() > visible
+                                ? input_buffer.substr(input_buffer.size() -
+                                                      visible)
+                                : input_buffer;
+        insert_into_buffer(input_box, 1, 1, shown);
+        add_border(input_box);
+        insert_buffer(center_buffer, 2, 3, input_box);
+
+        for (size_t i = 0; i < results.size(); i++) {
+            std::string line =
+                results[i].project_name + ": " + results[i].item.task;
+            if (line.size() > static_cast<size_t>(width - 4)) {
+                line = line.substr(0, width - 7) + "...";
+            }
+            if (static_cast<int>(i) == selected) {
+                insert_colored(center_buffer, 2, results_y + i, line,
+                               "\033[7;3m");
+            } else {
+                insert_into_buffer(center_buffer, 2, results_y + i, line);
+            }
+        }
+        if (results.empty() && !input_buffer.empty()) {
+            insert_colored(center_buffer, 2, results_y, "No todos found",
+                           "\033[3m");
+        }
+
+        add_border(center_buffer);
+        insert_buffer(buffer, start_x, start_y, center_buffer);
+
+        draw_buffer(buffer);
+        set_cursor_pos(start_x + 2 + 1 + shown.size() + 1, start_y + 4 + 1);
+
+        if (!wait_for_input()) continue;
+
+        ch = getchar();
+        if (ch == 27) {
+            if (!kbhit()) {
+                disable_cursor();
+                return false;
+            }
+            ch = getchar();
+            if (ch != 91) continue;
+            ch = getchar();
+            if (ch == 65 && selected > 0) {  // UP ARROW
+                selected--;
+            } else if (ch == 66 &&
+                       static_cast<size_t>(selected) + 1 < results.size()) {
+                selected++;  // DOWN ARROW
+            }
+        } else if (ch == 127) {
+            if (!input_buffer.empty()) {
+                input_buffer.pop_back();
+            }
+        } else if (ch == '\n') {
+            if (results.empty()) continue;
+            match = results[selected];
+            break;
+        } else if (ch >= ' ' && ch <= '~') {
+            input_buffer += ch;
+        }
+    }
+    clear_buffer(buffer);
+    disable_cursor();
+    return true;
+}
+
+// Finds a file by fuzzy matching the paths in files while typing. Returns
+// false when the finder is left with ESC.
+bool find_file_popup(frame_buffer &buffer, int screen_width,
+                     fuzzy_finder &files, std::string &path) {
+    enable_cursor();
+    int width = std::min(screen_width - 4, 100);
+    int height = std::min(buffer.height() - 2, 24);
+    frame_buffer center_buffer(width, height);
+    int start_x = (screen_width / 2) - (width / 2);
+    int start_y = (buffer.height() / 2) - (height / 2);
+
+    char ch;
+    std::string input_buffer;
+    std::string searched;
+    bool has_results = false;
+    std::vector<fuzzy_match> results;
+    int selected = 0;
+    int input_width = width - 4;
+    frame_buffer input_box(input_width, 3);
+
+    std::string message = "Find file:";
+    std::string info = "Use arrows to select, ENTER to open, ESC to quit.";
+    int middle = width / 2;
+    int results_y = 7;
+    int screen_height = buffer.height();
+    while (true) {
+        if (fit_to_screen(buffer, screen_width, screen_height)) {
+            start_x = (screen_width / 2) - (width / 2);
+            start_y = (buffer.height() / 2) - (height / 2);
+        }
+
+        if (!has_results || input_buffer != searched) {
+            results = files.search(input_buffer, height - results_y - 1);
+            searched = input_buffer;
+            has_results = true;
+            selected = 0;
+        }
+
+        clear_buffer(center_buffer);
+        clear_buffer(input_box);
+
+        insert_colored(center_buffer, middle - (message.size() / 2), 1, message,
+                       "\033[1;38;5;99m");
+        insert_colored(center_buffer, middle - (info.size() / 2), 2, info,
+                       "\033[3;36m");
+
+        std::string counts = std::to_string(files.matched()) + "/" +
+                             std::to_string(files.size());
+        size_t visible = input_width - 4 - counts.size();
+        std::string shown = input_buffer.size() > visible
+                                ? input_buffer.substr(input_buffer.size() -
+                                                      visible)
+                                : input_buffer;
+        insert_into_buffer(input_box, 1, 1, shown);
+        insert_into_buffer(input_box, input_width - 2 - counts.size(), 1,
+                           counts);
+        add_border(input_box);
+        insert_buffer(center_buffer, 2, 3, input_box);
+
+        size_t line_width = width - 4;
+        for (size_t i = 0; i < results.size(); i++) {
+            std::string line = files.at(results[i].index);
+            std::vector<int> positions =
+                files.positions(results[i].index, input_buffer);
+            // Long paths lose their start, the file name matters most.
+            if (line.size() > line_width) {
+                int cut = line.size() - line_width + 3;
+                line = "..." + line.substr(cut);
+                std::vector<int> kept;
+                for (int position : positions) {
+                    if (position >= cut) kept.push_back(position - cut + 3);
+                }
+                positions.swap(kept);
+            }
+            insert_highlighted(center_buffer, 2, results_y + i, line,
+                positions,
+                static_cast<int>(i) == selected ? "\033[7;3m" : "",
+                static_cast<int>(i) == selected ? "\033[7;1;33m"
+                                                : "\033[1;33m");
+        }
+        if (results.empty() && !input_buffer.empty()) {
+            insert_colored(center_buffer, 2, results_y, "No files found",
+                           "\033[3m");
+        }
+
+        add_border(center_buffer);
+        insert_buffer(buffer, start_x, start_y, center_buffer);
+
+        draw_buffer(buffer);
+        set_cursor_pos(start_x + 2 + 1 + shown.size() + 1, start_y + 4 + 1);
+
+        if (!wait_for_input()) continue;
+
+        ch = getchar();
+        if (ch == 27) {
+            if (!kbhit()) {
+                disable_cursor();
+                return false;
+            }
+            ch = getchar();
+            if (ch != 91) continue;
+            ch = getchar();
+            if (ch == 65 && selected > 0) {  // UP ARROW
+                selected--;
+            } else if (ch == 66 &&
+                       static_cast<size_t>(selected) + 1 < results.size()) {
+                selected++;  // DOWN ARROW
+            }
+        } else if (ch == 127) {
+            if (!input_buffer.empty()) {
+                input_buffer.pop_back();
+            }
+        } else if (ch == '\n') {
+            if (results.empty()) continue;
+            path = files.at(results[selected].index);
+            break;
+        } else if (ch >= ' ' && ch <= '~') {
+            input_buffer += ch;
+        }
+    }
+    clear_buffer(buffer);
+    disable_cursor();
+    return true;
+}
+
+std::string input_popup(frame_buffer &buffer,
                         const std::string message, int screen_width) {
     enable_cursor();
     int width = 48;
     int height = 10;
-    std::vector<std::string> center_buffer(height, std::string(width, ' '));
-    std::vector<styling> style_buffer;
+    frame_buffer center_buffer(width, height);
     int start_x = (screen_width / 2) - (width / 2);
-    int start_y = (buffer.size() / 2) - (height / 2);
+    int start_y = (buffer.height() / 2) - (height / 2);
 
     char ch;
     std::string input_buffer;
-    std::vector<std::string> input_box(4, std::string(38, ' '));
+    frame_buffer input_box(38, 4);
 
     int middle = width / 2;
     int message_pos = middle - (message.length() / 2);
     std::string info = "press ESC to quit.";
     int info_pos = middle - (info.length() / 2);
     int input_pos = 6;
+    int screen_height = buffer.height();
     while (true) {
-        int temp_width, temp_height;
-        get_console_size(temp_width, temp_height);
-        if (temp_width != screen_width) {
-            screen_width = temp_width;
-            buffer = std::vector(temp_height, std::string(screen_width, ' '));
+        if (fit_to_screen(buffer, screen_width, screen_height)) {
             start_x = (screen_width / 2) - (width / 2);
-            start_y = (buffer.size() / 2) - (height / 2);
+            start_y = (buffer.height() / 2) - (height / 2);
         }
-        clear_buffer(center_buffer, width);
-        clear_buffer(input_box, 38);
-        style_buffer.clear();
+        clear_buffer(center_buffer);
+        clear_buffer(input_box);
 
-        insert_colored(center_buffer, style_buffer, message_pos, 2, message,
+        insert_colored(center_buffer, message_pos, 2, message,
                        "\033[1;38;5;99m");
-        insert_colored(center_buffer, style_buffer, info_pos, 3, info,
-                       "\033[3;36m");
+        insert_colored(center_buffer, info_pos, 3, info, "\033[3;36m");
 
         bool longer = input_buffer.length() > 36;
         insert_into_buffer(
@@ -597,24 +1096,14 @@ std::string input_popup(std::vector<std::string> &buffer,
                 input_buffer.substr(36, input_buffer.size() - 36));
         }
 
-        add_border(input_box, 38);
-        for (int y = 0; y < 4; y++) {
-            insert_into_buffer(center_buffer, input_pos, 4 + y, input_box[y]);
-        }
-
-        add_border(center_buffer, width);
+        add_border(input_box);
+        insert_buffer(center_buffer, input_pos, 4, input_box);
 
-        for (int y = 0; y < height; y++) {
-            insert_into_buffer(buffer, start_x, start_y + y, center_buffer[y]);
-        }
+        add_border(center_buffer);
 
-        for (auto &style : style_buffer) {
-            style.x += start_x;
-            style.y += start_y;
-        }
+        insert_buffer(buffer, start_x, start_y, center_buffer);
 
-        clear_screen();
-        draw_buffer(buffer, style_buffer);
+        draw_buffer(buffer);
 
         int cursor_y = start_y + 4 + 1;
         if (input_buffer.length() > 35) {
@@ -647,7 +1136,7 @@ std::string input_popup(std::vector<std::string> &buffer,
             }
         }
     }
-    clear_buffer(buffer, screen_width);
+    clear_buffer(buffer);
     disable_cursor();
     return input_buffer;
 }
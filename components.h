@@ -1,19 +1,30 @@
 #ifndef COMPONENTS_H
 #define COMPONENTS_H
 #include "database.h"
+#include "fuzzy.h"
+#include "project_model.h"
+#include "status_cache.h"
+#include "todo_model.h"
+#include "tree_cache.h"
 #include "ui_library.h"
-#endif
 
-std::string get_git_status(project &project);
-void main_menu(sqlite3 *db, std::vector<std::string> &buffer,
-               std::vector<project> &projects, int screen_width,
-               int screen_height);
-void project_menu(sqlite3 *db, std::vector<std::string> &buffer,
-                  int screen_width, int screen_height, project &project);
-void popup(std::vector<std::string> &buffer, const std::string message,
+void main_menu(Database &db, frame_buffer &buffer,
+               project_model &model, int screen_width, int screen_height);
+void project_menu(Database &db, status_cache &statuses, tree_cache &trees,
+                  frame_buffer &buffer, int screen_width,
+                  int screen_height, project &project, int focus_todo = -1);
+void popup(frame_buffer &buffer, const std::string message,
            int screen_width, bool has_ok = true);
-int choice_popup(std::vector<std::string> &buffer, const std::string message,
+// Fetches every project in the background, showing progress until done.
+void fetch_popup(frame_buffer &buffer, int screen_width,
+                 const std::vector<project> &projects);
+int choice_popup(frame_buffer &buffer, const std::string message,
                  const std::string left, const std::string right,
                  int screen_width);
-std::string input_popup(std::vector<std::string> &buffer,
+bool search_popup(Database &db, frame_buffer &buffer,
+                  int screen_width, todo_match &match);
+bool find_file_popup(frame_buffer &buffer, int screen_width,
+                     fuzzy_finder &files, std::string &path);
+std::string input_popup(frame_buffer &buffer,
                         const std::string message, int screen_width);
+#endif
@@ -1,34 +1,286 @@
 #include "database.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #include "ui_library.h"
 
-void exit_program(sqlite3 *db, const std::string err_msg, int exitcode) {
+void exit_program(Database &db, const std::string err_msg, int exitcode) {
     clear_screen();
-    sqlite3_close(db);
+    WriteQueue::flush_all();
+    db.close();
     reset_raw_mode();
     set_cursor_pos(1, 1);
-    std::cout << "\033[?25h";  // reenable cursor
+    enable_cursor();
+    flush_output();
     std::cout << err_msg << std::endl;
     exit(exitcode);
 }
 
-int setup_database(sqlite3 *db) {
-    int rc;
+static void exit_on_error(Database &db) {
+    if (db.keeps_errors()) {
+        db.record_error();
+        return;
+    }
+    std::string err_msg = "Error: ";
+    err_msg += db.error();
+    exit_program(db, err_msg);
+}
+
+Database::Database(const std::string &location) : location(location) {
+    if (sqlite3_open(location.c_str(), &db) != SQLITE_OK) {
+        open_error = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        db = nullptr;
+        return;
+    }
+    sqlite3_busy_timeout(db, 5000);
+
+    // The mode is kept in the file, this only switches a new or old database.
+    // It stays a rollback journal where WAL is not possible, on a read-only
+    // directory or some network file systems.
+    bool wal = false;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL", -1, &stmt,
+                           nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char *mode = sqlite3_column_text(stmt, 0);
+            wal = mode != nullptr &&
+                  strcmp(reinterpret_cast<const char *>(mode), "wal") == 0;
+        }
+        sqlite3_finalize(stmt);
+    }
+    // Safe in WAL mode only, commits no longer wait for the WAL to be synced.
+    // A rollback journal keeps the default, FULL.
+    if (wal) sqlite3_exec(db, "PRAGMA synchronous = NORMAL", 0, 0, NULL);
+}
+
+Database::~Database() { close(); }
+
+const char *Database::error() const {
+    return db == nullptr ? open_error.c_str() : sqlite3_errmsg(db);
+}
+
+void Database::record_error() {
+    if (first_error.empty()) first_error = error();
+}
+
+void Database::close() {
+    write_queue.reset();
+    for (auto &[sql, stmt] : statements) {
+        sqlite3_finalize(stmt);
+    }
+    statements.clear();
+    sqlite3_close(db);
+    db = nullptr;
+}
+
+sqlite3_stmt *Database::prepare(const char *sql) {
+    auto it = statements.find(sql);
+    if (it != statements.end()) return it->second;
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt,
+                           NULL) != SQLITE_OK) {
+        exit_on_error(*this);
+        return nullptr;
+    }
+    statements.emplace(sql, stmt);
+    return stmt;
+}
+
+void Database::start_writer() {
+    if (!write_queue) write_queue = std::make_unique<WriteQueue>(location);
+}
+
+static std::mutex queues_lock;
+static std::vector<WriteQueue *> queues;
+
+WriteQueue::WriteQueue(const std::string &location) : db(location) {
+    if (!db.is_open()) exit_on_error(db);
+    db.keep_errors();
+    {
+        std::lock_guard<std::mutex> guard(queues_lock);
+        queues.push_back(this);
+    }
+    thread = std::thread(&WriteQueue::run, this);
+}
+
+WriteQueue::~WriteQueue() {
+    {
+        std::lock_guard<std::mutex> guard(queues_lock);
+        queues.erase(std::find(queues.begin(), queues.end(), this));
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+int WriteQueue::add_todo(int project_id, const std::string &task) {
+    exit_on_failure();
+    int id;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        id = next_temporary_id--;
+        queue.push_back({true, id, project_id, task});
+        queued++;
+    }
+    wake.notify_one();
+    return id;
+}
+
+void WriteQueue::remove_todo(int id) {
+    exit_on_failure();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back({false, id, -1, ""});
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void WriteQueue::flush() {
+    wait();
+    exit_on_failure();
+}
+
+void WriteQueue::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t target = queued;
+    done.wait(guard,
+              [&] { return committed >= target || !error.empty(); });
+}
+
+// The writer only stops on an error. Ending the program is left to the
+// thread that owns the queue, which is the one drawing the screen.
+void WriteQueue::exit_on_failure() {
+    std::string message;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (error.empty()) return;
+        message = "Error: " + error;
+    }
+    exit_program(db, message);
+}
+
+void WriteQueue::flush_all() {
+    std::lock_guard<std::mutex> guard(queues_lock);
+    for (WriteQueue *queue : queues) {
+        queue->wait();
+    }
+}
+
+void WriteQueue::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+
+        std::vector<write> batch;
+        batch.swap(queue);
+        uint64_t target = queued;
+        guard.unlock();
+
+        execute_simple_sql(db, "BEGIN");
+        for (const auto &write : batch) {
+            if (!db.failure().empty()) break;
+            apply(write);
+        }
+        execute_simple_sql(db, db.failure().empty() ? "COMMIT" : "ROLLBACK");
+
+        guard.lock();
+        if (!db.failure().empty()) {
+            error = db.failure();
+            committed = queued;
+            done.notify_all();
+            return;
+        }
+        committed = target;
+        done.notify_all();
+    }
+}
+
+void WriteQueue::apply(const write &write) {
+    if (write.is_add) {
+        Statement stmt(db,
+                       "INSERT INTO todos (project_id, task) VALUES (?, ?) "
+                       "RETURNING id");
+        stmt.bind(1, write.project_id);
+        stmt.bind(2, write.task);
+        if (stmt.step()) real_ids[write.id] = stmt.column_int(0);
+        stmt.step();
+        return;
+    }
+
+    int id = write.id;
+    if (id < 0) {
+        auto it = real_ids.find(id);
+        if (it == real_ids.end()) return;
+        id = it->second;
+    }
+    Statement stmt(db, "DELETE FROM todos WHERE id = ?");
+    stmt.bind(1, id);
+    stmt.run();
+}
+
+Statement::Statement(Database &db, const char *sql)
+    : db(db), stmt(db.prepare(sql)) {}
+
+Statement::~Statement() {
+    if (stmt == nullptr) return;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+void Statement::bind(int index, int value) {
+    sqlite3_bind_int(stmt, index, value);
+}
+
+void Statement::bind(int index, int64_t value) {
+    sqlite3_bind_int64(stmt, index, value);
+}
+
+void Statement::bind(int index, const std::string &value) {
+    sqlite3_bind_text(stmt, index, value.c_str(), value.size(),
+                      SQLITE_TRANSIENT);
+}
+
+bool Statement::step() {
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) return true;
+    if (rc != SQLITE_DONE) exit_on_error(db);
+    sqlite3_reset(stmt);
+    return false;
+}
+
+void Statement::run() {
+    if (sqlite3_step(stmt) != SQLITE_DONE) exit_on_error(db);
+    sqlite3_reset(stmt);
+}
+
+int Statement::column_int(int index) { return sqlite3_column_int(stmt, index); }
+
+int64_t Statement::column_int64(int index) {
+    return sqlite3_column_int64(stmt, index);
+}
+
+std::string Statement::column_text(int index) {
+    const char *text = (const char *)sqlite3_column_text(stmt, index);
+    return text == nullptr ? "" : text;
+}
+
+int setup_database(Database &db) {
     const char *projects =
         "CREATE TABLE IF NOT EXISTS projects ( "
         "id INTEGER PRIMARY KEY AUTOINCREMENT, "
         "name TEXT NOT NULL, "
         "path TEXT UNIQUE "
         ");";
-
-    rc = execute_simple_sql(db, projects);
-    if (rc) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
-    }
+    execute_simple_sql(db, projects);
 
     const char *todos =
         "CREATE TABLE IF NOT EXISTS todos ( "
@@ -37,135 +289,453 @@ int setup_database(sqlite3 *db) {
         "task TEXT NOT NULL, "
         "FOREIGN KEY (project_id) REFERENCES projects (id) "
         ");";
-    rc = execute_simple_sql(db, todos);
-    if (rc) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+    execute_simple_sql(db, todos);
+    execute_simple_sql(db,
+                       "CREATE INDEX IF NOT EXISTS todos_project_id "
+                       "ON todos (project_id);");
+
+    const char *discovery_index =
+        "CREATE TABLE IF NOT EXISTS discovery_index ( "
+        "path TEXT PRIMARY KEY, "
+        "mtime INTEGER NOT NULL, "
+        "inode INTEGER NOT NULL, "
+        "is_repo INTEGER NOT NULL "
+        ") WITHOUT ROWID;";
+    execute_simple_sql(db, discovery_index);
+
+    const char *settings =
+        "CREATE TABLE IF NOT EXISTS settings ( "
+        "key TEXT PRIMARY KEY, "
+        "value TEXT NOT NULL "
+        ");";
+    execute_simple_sql(db, settings);
+
+    const char *git_statuses =
+        "CREATE TABLE IF NOT EXISTS git_statuses ( "
+        "path TEXT PRIMARY KEY, "
+        "fingerprint TEXT NOT NULL, "
+        "status TEXT NOT NULL "
+        ");";
+    execute_simple_sql(db, git_statuses);
+
+    // Full text index over the todos, kept in sync by triggers. It is filled
+    // from the existing todos the first time it is created.
+    bool has_index;
+    {
+        Statement stmt(db,
+                       "SELECT 1 FROM sqlite_master WHERE type = 'table' AND "
+                       "name = 'todos_fts'");
+        has_index = stmt.step();
+    }
+    const char *todos_fts =
+        "CREATE VIRTUAL TABLE IF NOT EXISTS todos_fts USING fts5 ( "
+        "task, content = 'todos', content_rowid = 'id', prefix = '2 3' "
+        ");"
+        "CREATE TRIGGER IF NOT EXISTS todos_fts_insert AFTER INSERT ON todos "
+        "BEGIN "
+        "INSERT INTO todos_fts (rowid, task) VALUES (new.id, new.task); "
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS todos_fts_delete AFTER DELETE ON todos "
+        "BEGIN "
+        "INSERT INTO todos_fts (todos_fts, rowid, task) "
+        "VALUES ('delete', old.id, old.task); "
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS todos_fts_update AFTER UPDATE ON todos "
+        "BEGIN "
+        "INSERT INTO todos_fts (todos_fts, rowid, task) "
+        "VALUES ('delete', old.id, old.task); "
+        "INSERT INTO todos_fts (rowid, task) VALUES (new.id, new.task); "
+        "END;";
+    execute_simple_sql(db, todos_fts);
+    if (!has_index) {
+        execute_simple_sql(
+            db, "INSERT INTO todos_fts (todos_fts) VALUES ('rebuild');");
     }
 
     return 0;
 }
 
-int execute_simple_sql(sqlite3 *db, const char *sql) {
-    int rc = sqlite3_exec(db, sql, 0, 0, NULL);
+int execute_simple_sql(Database &db, const char *sql) {
+    int rc = sqlite3_exec(db.handle(), sql, 0, 0, NULL);
     if (rc != SQLITE_OK) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+        exit_on_error(db);
     }
     return 0;
 }
 
-int insert_projects(sqlite3 *db, const std::string name,
+int insert_projects(Database &db, const std::string name,
                     const std::string path) {
-    int rc;
-    const char *sql =
-        "INSERT OR IGNORE INTO projects (name, path) VALUES (?, ?)";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
-    }
+    Statement stmt(db,
+                   "INSERT OR IGNORE INTO projects (name, path) VALUES (?, ?)");
+    stmt.bind(1, name);
+    stmt.bind(2, path);
+    stmt.run();
+    return 0;
+}
 
-    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
+int get_project_id(Database &db, project &project) {
+    Statement stmt(db, "SELECT id FROM projects WHERE path = ?");
+    stmt.bind(1, project.path);
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+    int id = -1;
+    if (stmt.step()) {
+        id = stmt.column_int(0);
     }
-    sqlite3_finalize(stmt);
-    return 0;
+    return id;
 }
 
-int get_project_id(sqlite3 *db, project &project) {
-    int rc;
-    const std::string sql =
-        "SELECT id from projects WHERE path=\'" + project.path + "\'";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+// Inserts or updates all projects with one prepared upsert and fills in their
+// ids. Rows are committed in chunks so a cold start with thousands of
+// repositories costs a handful of commits instead of one per project.
+void register_projects(Database &db, std::vector<project> &projects) {
+    const size_t CHUNK_SIZE = 1024;
+    if (projects.empty()) return;
+
+    Statement stmt(db,
+                   "INSERT INTO projects (name, path) VALUES (?, ?) "
+                   "ON CONFLICT (path) DO UPDATE SET name = excluded.name "
+                   "RETURNING id");
+    for (size_t i = 0; i < projects.size(); i++) {
+        if (i % CHUNK_SIZE == 0) execute_simple_sql(db, "BEGIN");
+
+        project &project = projects[i];
+        stmt.bind(1, project.name);
+        stmt.bind(2, project.path);
+        if (!stmt.step()) exit_on_error(db);
+        project.id = stmt.column_int(0);
+        // Finish the statement so the row is written before the commit.
+        stmt.step();
+
+        if (i % CHUNK_SIZE == CHUNK_SIZE - 1 || i == projects.size() - 1) {
+            execute_simple_sql(db, "COMMIT");
+        }
     }
+}
 
-    int id;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        id = sqlite3_column_int(stmt, 0);
+void rename_project(Database &db, const std::string &from,
+                    const std::string &to) {
+    const std::string name = to.substr(to.rfind('/') + 1);
+    {
+        Statement stmt(
+            db,
+            "UPDATE OR IGNORE projects SET name = ?, path = ? WHERE path = ?");
+        stmt.bind(1, name);
+        stmt.bind(2, to);
+        stmt.bind(3, from);
+        stmt.run();
     }
 
-    return id;
+    // The destination may already be a known project, make sure it exists
+    // either way so get_project_id finds it.
+    insert_projects(db, name, to);
 }
 
-std::vector<todo> get_todos(sqlite3 *db, const project project) {
+std::vector<todo> get_todos(Database &db, const project project) {
+    // Reads have to see the writes queued before them.
+    if (db.writer() != nullptr) db.writer()->flush();
+
     std::vector<todo> todos;
-    int rc;
-    const std::string sql = "SELECT id, task FROM todos WHERE project_id=" +
-                            std::to_string(project.id);
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+    Statement stmt(db, "SELECT id, task FROM todos WHERE project_id = ?");
+    stmt.bind(1, project.id);
+
+    while (stmt.step()) {
+        todos.push_back({stmt.column_int(0), project.id, stmt.column_text(1)});
     }
+    return todos;
+}
+
+// The pages below read the todos of a project in id order, seeking on id so
+// no page costs more than the rows it returns. Like every read they wait for
+// the queued writes first.
+void get_todo_range(Database &db, int project_id, size_t &count, int &max_id) {
+    if (db.writer() != nullptr) db.writer()->flush();
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        int id = sqlite3_column_int(stmt, 0);
-        const std::string task = (const char *)sqlite3_column_text(stmt, 1);
-        todos.push_back({id, project.id, task});
+    Statement stmt(db,
+                   "SELECT count(*), coalesce(max(id), 0) FROM todos "
+                   "WHERE project_id = ?");
+    stmt.bind(1, project_id);
+    count = 0;
+    max_id = 0;
+    if (stmt.step()) {
+        count = stmt.column_int64(0);
+        max_id = stmt.column_int(1);
     }
+}
 
+std::vector<todo> get_todos_after(Database &db, int project_id, int after_id,
+                                  int max_id, size_t limit) {
+    if (db.writer() != nullptr) db.writer()->flush();
+
+    std::vector<todo> todos;
+    Statement stmt(db,
+                   "SELECT id, task FROM todos WHERE project_id = ? AND "
+                   "id > ? AND id <= ? ORDER BY id LIMIT ?");
+    stmt.bind(1, project_id);
+    stmt.bind(2, after_id);
+    stmt.bind(3, max_id);
+    stmt.bind(4, static_cast<int64_t>(limit));
+    while (stmt.step()) {
+        todos.push_back({stmt.column_int(0), project_id, stmt.column_text(1)});
+    }
     return todos;
 }
 
-void add_todo(sqlite3 *db, const project project, const std::string task) {
-    int rc;
-    const char *sql = "INSERT INTO todos (project_id, task) VALUES (?, ?)";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+// Returns the rows in descending id order.
+std::vector<todo> get_todos_before(Database &db, int project_id, int before_id,
+                                   size_t limit) {
+    if (db.writer() != nullptr) db.writer()->flush();
+
+    std::vector<todo> todos;
+    Statement stmt(db,
+                   "SELECT id, task FROM todos WHERE project_id = ? AND "
+                   "id < ? ORDER BY id DESC LIMIT ?");
+    stmt.bind(1, project_id);
+    stmt.bind(2, before_id);
+    stmt.bind(3, static_cast<int64_t>(limit));
+    while (stmt.step()) {
+        todos.push_back({stmt.column_int(0), project_id, stmt.column_text(1)});
     }
+    return todos;
+}
+
+// Only used to jump to an arbitrary position, scrolling seeks on id.
+int get_todo_id_at(Database &db, int project_id, int max_id, size_t offset) {
+    if (db.writer() != nullptr) db.writer()->flush();
+
+    Statement stmt(db,
+                   "SELECT id FROM todos WHERE project_id = ? AND id <= ? "
+                   "ORDER BY id LIMIT 1 OFFSET ?");
+    stmt.bind(1, project_id);
+    stmt.bind(2, max_id);
+    stmt.bind(3, static_cast<int64_t>(offset));
+    return stmt.step() ? stmt.column_int(0) : -1;
+}
+
+size_t count_todos_before(Database &db, int project_id, int id) {
+    if (db.writer() != nullptr) db.writer()->flush();
+
+    Statement stmt(db,
+                   "SELECT count(*) FROM todos WHERE project_id = ? AND id < ?");
+    stmt.bind(1, project_id);
+    stmt.bind(2, id);
+    return stmt.step() ? stmt.column_int64(0) : 0;
+}
 
-    sqlite3_bind_int(stmt, 1, project.id);
-    sqlite3_bind_text(stmt, 2, task.c_str(), -1, SQLITE_TRANSIENT);
+// Number of todos per project, indexed by project id.
+std::vector<int> get_todo_counts(Database &db) {
+    if (db.writer() != nullptr) db.writer()->flush();
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+    std::vector<int> counts;
+    Statement stmt(db,
+                   "SELECT project_id, count(*) FROM todos "
+                   "GROUP BY project_id");
+    while (stmt.step()) {
+        int id = stmt.column_int(0);
+        if (id < 0) continue;
+        if (static_cast<size_t>(id) >= counts.size()) counts.resize(id + 1);
+        counts[id] = stmt.column_int(1);
     }
-    sqlite3_finalize(stmt);
+    return counts;
 }
 
-void remove_todo(sqlite3 *db, const todo todo) {
-    int rc;
-    const std::string sql =
-        "DELETE FROM todos WHERE id=" + std::to_string(todo.id);
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+// Turns what the user typed into an FTS5 query where every word is matched
+// as a prefix. Words are quoted so FTS5 syntax in them is taken literally.
+static std::string prefix_query(const std::string &input) {
+    std::string query;
+    size_t pos = 0;
+    while (pos < input.size()) {
+        size_t start = input.find_first_not_of(' ', pos);
+        if (start == std::string::npos) break;
+        size_t end = input.find(' ', start);
+        if (end == std::string::npos) end = input.size();
+
+        std::string word = input.substr(start, end - start);
+        if (!query.empty()) query += ' ';
+        query += '"';
+        for (char c : word) {
+            if (c == '"') query += '"';
+            query += c;
+        }
+        query += "\"*";
+        pos = end;
+    }
+    return query;
+}
+
+// Best matching todos across all projects, ranked by bm25.
+std::vector<todo_match> search_todos(Database &db, const std::string &query,
+                                     int limit) {
+    std::vector<todo_match> matches;
+    const std::string match = prefix_query(query);
+    // A negative LIMIT would mean no limit to SQLite.
+    if (match.empty() || limit <= 0) return matches;
+    if (db.writer() != nullptr) db.writer()->flush();
+
+    Statement stmt(db,
+                   "SELECT todos.id, todos.project_id, todos.task, "
+                   "projects.name FROM todos_fts "
+                   "JOIN todos ON todos.id = todos_fts.rowid "
+                   "JOIN projects ON projects.id = todos.project_id "
+                   "WHERE todos_fts MATCH ? ORDER BY rank LIMIT ?");
+    stmt.bind(1, match);
+    stmt.bind(2, limit);
+    while (stmt.step()) {
+        matches.push_back(
+            {{stmt.column_int(0), stmt.column_int(1), stmt.column_text(2)},
+             stmt.column_text(3)});
+    }
+    return matches;
+}
+
+int add_todo(Database &db, const project project, const std::string task) {
+    if (db.writer() != nullptr) {
+        return db.writer()->add_todo(project.id, task);
+    }
+
+    Statement stmt(db, "INSERT INTO todos (project_id, task) VALUES (?, ?)");
+    stmt.bind(1, project.id);
+    stmt.bind(2, task);
+    stmt.run();
+    return sqlite3_last_insert_rowid(db.handle());
+}
+
+void remove_todo(Database &db, const todo todo) {
+    if (db.writer() != nullptr) {
+        db.writer()->remove_todo(todo.id);
+        return;
+    }
+
+    Statement stmt(db, "DELETE FROM todos WHERE id = ?");
+    stmt.bind(1, todo.id);
+    stmt.run();
+}
+
+std::unordered_map<std::string, int> get_project_ids(Database &db) {
+    std::unordered_map<std::string, int> ids;
+    Statement stmt(db, "SELECT id, path FROM projects");
+    while (stmt.step()) {
+        ids[stmt.column_text(1)] = stmt.column_int(0);
+    }
+    return ids;
+}
+
+// Removes the projects below root that were not found again. Only the known
+// projects, those there before the walk started, are candidates: one added
+// in the meantime, by the watcher, may be in a directory the walk had
+// already passed. Projects that still own todos are kept so no todos are
+// lost with them.
+void prune_projects(Database &db, const std::string &root,
+                    const std::unordered_map<std::string, int> &known,
+                    const std::unordered_set<std::string> &found) {
+    std::string prefix = root;
+    if (prefix.back() != '/') prefix += '/';
+
+    std::vector<std::string> missing;
+    for (const auto &[path, id] : known) {
+        if (path.compare(0, prefix.size(), prefix) == 0 && !found.count(path)) {
+            missing.push_back(path);
+        }
+    }
+    if (missing.empty()) return;
+
+    Statement stmt(db,
+                   "DELETE FROM projects WHERE path = ? AND NOT EXISTS "
+                   "(SELECT 1 FROM todos WHERE todos.project_id = projects.id)");
+    Statement status(db, "DELETE FROM git_statuses WHERE path = ?");
+    execute_simple_sql(db, "BEGIN");
+    for (const auto &path : missing) {
+        stmt.bind(1, path);
+        stmt.run();
+        status.bind(1, path);
+        status.run();
     }
+    execute_simple_sql(db, "COMMIT");
+}
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        std::string err_msg = "Error: ";
-        err_msg += sqlite3_errmsg(db);
-        exit_program(db, err_msg);
+std::unordered_map<std::string, stored_status> get_git_statuses(
+    Database &db) {
+    std::unordered_map<std::string, stored_status> statuses;
+    Statement stmt(db, "SELECT path, fingerprint, status FROM git_statuses");
+    while (stmt.step()) {
+        statuses[stmt.column_text(0)] = {stmt.column_text(1),
+                                         stmt.column_text(2)};
     }
+    return statuses;
+}
+
+void save_git_status(Database &db, const std::string &path,
+                     const stored_status &status) {
+    Statement stmt(db,
+                   "INSERT OR REPLACE INTO git_statuses "
+                   "(path, fingerprint, status) VALUES (?, ?, ?)");
+    stmt.bind(1, path);
+    stmt.bind(2, status.fingerprint);
+    stmt.bind(3, status.status);
+    stmt.run();
+}
+
+static std::string get_setting(Database &db, const char *key) {
+    Statement stmt(db, "SELECT value FROM settings WHERE key = ?");
+    stmt.bind(1, std::string(key));
+    return stmt.step() ? stmt.column_text(0) : "";
+}
+
+static void set_setting(Database &db, const char *key,
+                        const std::string &value) {
+    Statement stmt(db,
+                   "INSERT OR REPLACE INTO settings (key, value) VALUES (?, ?)");
+    stmt.bind(1, std::string(key));
+    stmt.bind(2, value);
+    stmt.run();
+}
 
-    sqlite3_finalize(stmt);
+void load_directory_index(Database &db, directory_index &index,
+                          const std::string &signature) {
+    // An index built for another root or other options would hide
+    // directories, so it is thrown away when the index is saved again.
+    if (get_setting(db, "discovery_signature") != signature) return;
+
+    Statement stmt(db, "SELECT path, mtime, inode, is_repo FROM discovery_index");
+    while (stmt.step()) {
+        index.add(stmt.column_text(0),
+                  {stmt.column_int64(1),
+                   static_cast<uint64_t>(stmt.column_int64(2)),
+                   stmt.column_int(3) != 0});
+    }
+}
+
+void save_directory_index(Database &db, const directory_index &index,
+                          const std::string &signature) {
+    bool same_signature =
+        get_setting(db, "discovery_signature") == signature;
+    const std::vector<std::string> stale = index.stale();
+    if (same_signature && stale.empty() && index.changed().empty()) return;
+
+    execute_simple_sql(db, "BEGIN");
+    if (!same_signature) {
+        execute_simple_sql(db, "DELETE FROM discovery_index");
+        set_setting(db, "discovery_signature", signature);
+    }
+
+    {
+        Statement stmt(db, "DELETE FROM discovery_index WHERE path = ?");
+        for (const auto &path : stale) {
+            stmt.bind(1, path);
+            stmt.run();
+        }
+    }
+
+    {
+        Statement stmt(db,
+                       "INSERT OR REPLACE INTO discovery_index "
+                       "(path, mtime, inode, is_repo) VALUES (?, ?, ?, ?)");
+        for (const auto &[path, record] : index.changed()) {
+            stmt.bind(1, path);
+            stmt.bind(2, record.mtime);
+            stmt.bind(3, static_cast<int64_t>(record.inode));
+            stmt.bind(4, record.is_repo ? 1 : 0);
+            stmt.run();
+        }
+    }
+    execute_simple_sql(db, "COMMIT");
 }
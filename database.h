@@ -2,28 +2,191 @@
 #define DATABASE_H
 #include <sqlite3.h>
 
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#endif
+
+#include "discovery.h"
 
 struct project {
     int id;
-    const std::string name;
-    const std::string path;
+    std::string name;
+    std::string path;
 };
 
 struct todo {
     int id;
     int project_id;
-    const std::string task;
+    std::string task;
+};
+
+struct todo_match {
+    todo item;
+    std::string project_name;
+};
+
+// The output of `git status -bs` for a project, and the fingerprint of the
+// repository it was taken from.
+struct stored_status {
+    std::string fingerprint;
+    std::string status;
+};
+
+class WriteQueue;
+
+// Owns a connection and compiles every query once. Statements are kept for
+// the lifetime of the connection and handed out again through Statement.
+class Database {
+   public:
+    explicit Database(const std::string &location);
+    ~Database();
+    Database(const Database &) = delete;
+    Database &operator=(const Database &) = delete;
+
+    bool is_open() const { return db != nullptr; }
+    const std::string &path() const { return location; }
+    const char *error() const;
+    // Keeps the first error for failure instead of ending the program, for
+    // connections used off the UI thread. Statements then do nothing.
+    void keep_errors() { keeping_errors = true; }
+    bool keeps_errors() const { return keeping_errors; }
+    void record_error();
+    const std::string &failure() const { return first_error; }
+    sqlite3 *handle() { return db; }
+    void close();
+
+    // Sends todo mutations to a background writer from now on.
+    void start_writer();
+    WriteQueue *writer() { return write_queue.get(); }
+
+    // Statements are cached by the address of sql, which has to be a string
+    // literal or otherwise outlive the connection.
+    sqlite3_stmt *prepare(const char *sql);
+    // Number of statements compiled so far, every other call was a cache hit.
+    size_t compiled() const { return statements.size(); }
+
+   private:
+    sqlite3 *db = nullptr;
+    const std::string location;
+    std::string open_error = "database is not open";
+    bool keeping_errors = false;
+    std::string first_error;
+    std::unordered_map<const char *, sqlite3_stmt *> statements;
+    std::unique_ptr<WriteQueue> write_queue;
 };
 
-int setup_database(sqlite3 *db);
-int execute_simple_sql(sqlite3 *db, const char *sql);
-int insert_projects(sqlite3 *db, const std::string name,
+// A cached statement in use. It is reset and its bindings cleared when it goes
+// out of scope, so the next user finds it ready. Errors end the program
+// through exit_program, like every other database call.
+class Statement {
+   public:
+    Statement(Database &db, const char *sql);
+    ~Statement();
+    Statement(const Statement &) = delete;
+    Statement &operator=(const Statement &) = delete;
+
+    void bind(int index, int value);
+    void bind(int index, int64_t value);
+    void bind(int index, const std::string &value);
+    // Returns true while there is a row to read.
+    bool step();
+    // Steps a statement that returns no rows.
+    void run();
+
+    int column_int(int index);
+    int64_t column_int64(int index);
+    std::string column_text(int index);
+
+   private:
+    Database &db;
+    sqlite3_stmt *stmt;
+};
+
+// Applies todo mutations on a background thread with its own connection, so a
+// slow disk does not stall the UI on every keypress. Whatever is queued when
+// the thread wakes up is written in one transaction.
+class WriteQueue {
+   public:
+    explicit WriteQueue(const std::string &location);
+    ~WriteQueue();
+
+    // Returns a temporary, negative id that remove_todo accepts until the
+    // todo is read back with its real id.
+    int add_todo(int project_id, const std::string &task);
+    void remove_todo(int id);
+    // Blocks until everything queued so far is committed. Should the writer
+    // have failed, this and the calls above end the program instead.
+    void flush();
+    // Waits for every live queue, used on the way out of the program.
+    static void flush_all();
+
+   private:
+    struct write {
+        bool is_add;
+        int id;
+        int project_id;
+        std::string task;
+    };
+
+    Database db;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<write> queue;
+    uint64_t queued = 0;
+    uint64_t committed = 0;
+    int next_temporary_id = -1;
+    bool stopping = false;
+    // The error the writer stopped on, for the owning thread to exit with.
+    std::string error;
+    // Real ids of temporary ones, only touched by the writer thread.
+    std::unordered_map<int, int> real_ids;
+    std::thread thread;
+
+    void run();
+    void apply(const write &write);
+    void wait();
+    void exit_on_failure();
+};
+
+int setup_database(Database &db);
+int execute_simple_sql(Database &db, const char *sql);
+int insert_projects(Database &db, const std::string name,
                     const std::string path);
-int get_project_id(sqlite3 *db, project &project);
-std::vector<todo> get_todos(sqlite3 *db, const project project);
-void add_todo(sqlite3 *db, const project project, const std::string task);
-void remove_todo(sqlite3 *db, const todo todo);
-void exit_program(sqlite3 *db, const std::string err_msg, int exit_code = 1);
+int get_project_id(Database &db, project &project);
+void register_projects(Database &db, std::vector<project> &projects);
+void rename_project(Database &db, const std::string &from,
+                    const std::string &to);
+std::vector<todo> get_todos(Database &db, const project project);
+std::vector<int> get_todo_counts(Database &db);
+void get_todo_range(Database &db, int project_id, size_t &count, int &max_id);
+std::vector<todo> get_todos_after(Database &db, int project_id, int after_id,
+                                  int max_id, size_t limit);
+std::vector<todo> get_todos_before(Database &db, int project_id, int before_id,
+                                   size_t limit);
+int get_todo_id_at(Database &db, int project_id, int max_id, size_t offset);
+size_t count_todos_before(Database &db, int project_id, int id);
+std::vector<todo_match> search_todos(Database &db, const std::string &query,
+                                     int limit);
+int add_todo(Database &db, const project project, const std::string task);
+void remove_todo(Database &db, const todo todo);
+std::unordered_map<std::string, int> get_project_ids(Database &db);
+void prune_projects(Database &db, const std::string &root,
+                    const std::unordered_map<std::string, int> &known,
+                    const std::unordered_set<std::string> &found);
+std::unordered_map<std::string, stored_status> get_git_statuses(
+    Database &db);
+void save_git_status(Database &db, const std::string &path,
+                     const stored_status &status);
+void load_directory_index(Database &db, directory_index &index,
+                          const std::string &signature);
+void save_directory_index(Database &db, const directory_index &index,
+                          const std::string &signature);
+void exit_program(Database &db, const std::string err_msg, int exit_code = 1);
+#endif
@@ -0,0 +1,377 @@
+#include "discovery.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include "tree_walker.h"
+
+namespace {
+
+struct file_id {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const file_id &other) const {
+        return dev == other.dev && ino == other.ino;
+    }
+};
+
+struct file_id_hash {
+    size_t operator()(const file_id &id) const {
+        return std::hash<dev_t>()(id.dev) * 31 + std::hash<ino_t>()(id.ino);
+    }
+};
+
+int64_t mtime_of(const struct stat &st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+           st.st_mtim.tv_nsec;
+}
+
+// Kept for directories that were not read, which matches no directory. They
+// stay listed below their parent, so they are tried again on the next run
+// even when the parent is served from the index.
+const directory_record UNREAD = {-1, 0, false};
+
+struct work_queue {
+    std::mutex lock;
+    std::deque<std::string> dirs;
+};
+
+// Every worker owns a deque. It pushes and pops at the back of its own deque
+// and steals from the front of the others when it runs dry, so the big
+// directories near the root get spread out over the pool early on.
+class discovery_pool {
+   public:
+    discovery_pool(const discovery_options &options,
+                   const std::function<void(const std::string &)> &on_found,
+                   directory_index *index)
+        : options(options),
+          on_found(on_found),
+          index(index),
+          prune(options.prune.begin(), options.prune.end()) {
+        unsigned int count = options.threads;
+        if (count == 0) count = std::thread::hardware_concurrency();
+        if (count == 0) count = 1;
+        for (unsigned int i = 0; i < count; i++) {
+            queues.push_back(std::make_unique<work_queue>());
+        }
+    }
+
+    void run(std::string root) {
+        while (root.size() > 1 && root.back() == '/') root.pop_back();
+        struct stat st;
+        if (stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+        push(0, root);
+        // The calling thread is the first worker, a pool of one starts no
+        // thread at all.
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < queues.size(); i++) {
+            workers.emplace_back(&discovery_pool::work, this, i);
+        }
+        work(0);
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+   private:
+    const discovery_options &options;
+    const std::function<void(const std::string &)> &on_found;
+    directory_index *index;
+    const std::unordered_set<std::string> prune;
+
+    std::vector<std::unique_ptr<work_queue>> queues;
+    // Directories that are queued or being scanned. The walk is done once
+    // this drops to zero.
+    std::atomic<size_t> pending = 0;
+    std::atomic<size_t> queued = 0;
+    std::mutex idle_lock;
+    std::condition_variable idle;
+
+    std::mutex visited_lock;
+    std::unordered_set<file_id, file_id_hash> visited;
+    std::mutex found_lock;
+
+    void push(size_t worker, std::string dir) {
+        pending++;
+        {
+            std::lock_guard<std::mutex> guard(queues[worker]->lock);
+            queues[worker]->dirs.push_back(std::move(dir));
+        }
+        queued++;
+        {
+            std::lock_guard<std::mutex> guard(idle_lock);
+        }
+        idle.notify_one();
+    }
+
+    bool pop(size_t worker, std::string &dir) {
+        work_queue &own = *queues[worker];
+        {
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.dirs.empty()) {
+                dir = std::move(own.dirs.back());
+                own.dirs.pop_back();
+                queued--;
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); i++) {
+            work_queue &victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.dirs.empty()) {
+                dir = std::move(victim.dirs.front());
+                victim.dirs.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t worker) {
+        std::string dir;
+        while (true) {
+            if (pop(worker, dir)) {
+                scan(worker, dir);
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> guard(idle_lock);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(idle_lock);
+            idle.wait(lock, [this] { return pending == 0 || queued > 0; });
+            if (pending == 0) return;
+        }
+    }
+
+    bool mark_visited(const struct stat &st) {
+        std::lock_guard<std::mutex> guard(visited_lock);
+        return visited.insert({st.st_dev, st.st_ino}).second;
+    }
+
+    bool is_directory(int dir_fd, const char *name, unsigned char type) {
+        struct stat st;
+        switch (type) {
+            case DT_DIR:
+                return true;
+            case DT_LNK:
+                if (!options.follow_symlinks) return false;
+                // Links are resolved here so loops can be caught by the
+                // visited set before they are queued.
+                if (fstatat(dir_fd, name, &st, 0) != 0) return false;
+                if (!S_ISDIR(st.st_mode)) return false;
+                {
+                    std::lock_guard<std::mutex> guard(visited_lock);
+                    return !visited.count({st.st_dev, st.st_ino});
+                }
+            case DT_UNKNOWN:
+                return entry_type(dir_fd, name, type, false) ==
+                       node_type::directory;
+            default:
+                return false;
+        }
+    }
+
+    void found(const std::string &dir) {
+        std::lock_guard<std::mutex> guard(found_lock);
+        on_found(dir);
+    }
+
+    // Serves a directory from the index when it has not changed since the
+    // last run, which costs a single stat instead of reading it.
+    bool scan_cached(size_t worker, const std::string &dir) {
+        const directory_record *record = index->find(dir);
+        if (record == nullptr) return false;
+
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return true;
+        if (record->mtime != mtime_of(st) || record->inode != st.st_ino) {
+            return false;
+        }
+        index->keep(dir);
+        if (!mark_visited(st)) return true;
+
+        if (record->is_repo) {
+            found(dir);
+            if (!options.nested_repos) return true;
+        }
+        if (const auto *children = index->children(dir)) {
+            for (const auto &child : *children) {
+                push(worker, child);
+            }
+        }
+        return true;
+    }
+
+    void scan(size_t worker, const std::string &dir) {
+        if (options.cancel != nullptr && *options.cancel) return;
+        if (index != nullptr && scan_cached(worker, dir)) return;
+
+        int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct stat st;
+        if (dir_fd < 0 || fstat(dir_fd, &st) != 0 || !mark_visited(st)) {
+            if (dir_fd >= 0) close(dir_fd);
+            if (index != nullptr) index->update(dir, UNREAD);
+            return;
+        }
+
+        bool is_repo = false;
+        std::vector<std::string> children;
+        dir_reader reader(dir_fd);
+        const char *name;
+        unsigned char type;
+        while (reader.next(name, type)) {
+            if (strcmp(name, ".git") == 0) {
+                // Submodules and worktrees use a .git file instead of a
+                // directory, both mark a repository root.
+                is_repo = true;
+                continue;
+            }
+            if (prune.count(name)) continue;
+            if (!is_directory(dir_fd, name, type)) continue;
+
+            std::string child = dir;
+            if (child.back() != '/') child += '/';
+            child += name;
+            children.push_back(std::move(child));
+        }
+        close(dir_fd);
+
+        if (index != nullptr) {
+            index->update(dir, {mtime_of(st), st.st_ino, is_repo});
+        }
+
+        if (is_repo) {
+            found(dir);
+            if (!options.nested_repos) return;
+        }
+
+        for (auto &child : children) {
+            push(worker, std::move(child));
+        }
+    }
+};
+
+}  // namespace
+
+void directory_index::add(const std::string &path,
+                          const directory_record &record) {
+    records[path] = record;
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos && slash + 1 < path.size()) {
+        child_dirs[slash == 0 ? "/" : path.substr(0, slash)].push_back(path);
+    }
+}
+
+const directory_record *directory_index::find(const std::string &path) const {
+    auto it = records.find(path);
+    return it == records.end() ? nullptr : &it->second;
+}
+
+const std::vector<std::string> *directory_index::children(
+    const std::string &path) const {
+    auto it = child_dirs.find(path);
+    return it == child_dirs.end() ? nullptr : &it->second;
+}
+
+void directory_index::keep(const std::string &path) {
+    std::lock_guard<std::mutex> guard(lock);
+    kept.insert(path);
+}
+
+void directory_index::update(const std::string &path,
+                             const directory_record &record) {
+    std::lock_guard<std::mutex> guard(lock);
+    kept.insert(path);
+    const directory_record *old = find(path);
+    if (old == nullptr || old->mtime != record.mtime ||
+        old->inode != record.inode || old->is_repo != record.is_repo) {
+        updated[path] = record;
+    }
+}
+
+std::vector<std::string> directory_index::stale() const {
+    std::vector<std::string> paths;
+    for (const auto &[path, record] : records) {
+        if (!kept.count(path)) paths.push_back(path);
+    }
+    return paths;
+}
+
+std::vector<std::string> default_prune_list() {
+    return {"node_modules", "__pycache__", ".cache", ".venv", "venv",
+            ".tox",         ".npm",        ".cargo", ".rustup", "target",
+            "build",        "dist"};
+}
+
+discovery_options discovery_options_from_env() {
+    discovery_options options;
+    options.prune = default_prune_list();
+
+    // PROJECTS_PRUNE replaces the default prune list with a colon separated
+    // list of directory names, an empty value disables pruning.
+    const char *prune = std::getenv("PROJECTS_PRUNE");
+    if (prune != nullptr) {
+        options.prune.clear();
+        std::string list = prune;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(':', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) {
+                options.prune.push_back(list.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+    }
+
+    const char *nested = std::getenv("PROJECTS_NESTED");
+    if (nested != nullptr && nested[0] != '\0' && strcmp(nested, "0") != 0) {
+        options.nested_repos = true;
+    }
+
+    const char *threads = std::getenv("PROJECTS_THREADS");
+    if (threads != nullptr) {
+        options.threads = std::strtoul(threads, nullptr, 10);
+    }
+
+    return options;
+}
+
+std::string discovery_signature(const std::string &root,
+                                const discovery_options &options) {
+    std::vector<std::string> prune = options.prune;
+    std::sort(prune.begin(), prune.end());
+
+    std::string signature = root;
+    signature += options.nested_repos ? ";nested" : ";";
+    signature += options.follow_symlinks ? ";follow" : ";";
+    for (const auto &name : prune) {
+        signature += ":" + name;
+    }
+    return signature;
+}
+
+void discover_projects(
+    const std::string &root, const discovery_options &options,
+    const std::function<void(const std::string &)> &on_found,
+    directory_index *index) {
+    discovery_pool pool(options, on_found, index);
+    pool.run(root);
+}
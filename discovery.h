@@ -0,0 +1,75 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct discovery_options {
+    // Directory names that are never descended into. ".git" is always
+    // skipped, regardless of this list.
+    std::vector<std::string> prune;
+    // Keep walking below a repository root so nested repositories and
+    // submodules are reported as well.
+    bool nested_repos = false;
+    bool follow_symlinks = true;
+    // Number of worker threads, 0 picks the hardware concurrency.
+    unsigned int threads = 0;
+    // Stops the walk early once set.
+    const std::atomic<bool> *cancel = nullptr;
+};
+
+struct directory_record {
+    int64_t mtime;  // nanoseconds
+    uint64_t inode;
+    bool is_repo;
+};
+
+// Scan results of the previous run, keyed by directory path. A directory whose
+// mtime and inode still match its record is not read again, its children are
+// taken from the records below it instead.
+class directory_index {
+   public:
+    // Loading, single threaded.
+    void add(const std::string &path, const directory_record &record);
+
+    // Lookups made by the scanning threads once loading is done.
+    const directory_record *find(const std::string &path) const;
+    const std::vector<std::string> *children(const std::string &path) const;
+    void keep(const std::string &path);
+    void update(const std::string &path, const directory_record &record);
+
+    // Results of the walk, read once it has finished.
+    const std::unordered_map<std::string, directory_record> &changed() const {
+        return updated;
+    }
+    std::vector<std::string> stale() const;
+
+   private:
+    std::unordered_map<std::string, directory_record> records;
+    std::unordered_map<std::string, std::vector<std::string>> child_dirs;
+
+    std::mutex lock;
+    std::unordered_set<std::string> kept;
+    std::unordered_map<std::string, directory_record> updated;
+};
+
+std::vector<std::string> default_prune_list();
+discovery_options discovery_options_from_env();
+// Identifies the root and options an index was built with, an index is only
+// reused by a walk with the same signature.
+std::string discovery_signature(const std::string &root,
+                                const discovery_options &options);
+// Walks root in parallel and calls on_found for every repository root as soon
+// as it is found. Calls to on_found are serialized, so the callback does not
+// need its own locking. When an index is given, unchanged directories are
+// served from it and the index records what changed.
+void discover_projects(const std::string &root,
+                       const discovery_options &options,
+                       const std::function<void(const std::string &)> &on_found,
+                       directory_index *index = nullptr);
+#endif
@@ -0,0 +1,106 @@
+#include "event_loop.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+
+#include "ui_library.h"
+
+using event_clock = std::chrono::steady_clock;
+
+// Background updates are drawn at most this often.
+static const auto FRAME_INTERVAL = std::chrono::milliseconds(25);
+
+static int WAKE_FD = -1;
+static volatile sig_atomic_t RESIZED = 0;
+static int WIDTH = 0;
+static int HEIGHT = 0;
+static event_clock::time_point NEXT_FRAME;
+
+// Only sets the flag, the size is read on the UI thread. The write makes a
+// wait that is already blocking return.
+static void on_resize(int) {
+    int saved = errno;
+    RESIZED = 1;
+    uint64_t one = 1;
+    write(WAKE_FD, &one, sizeof(one));
+    errno = saved;
+}
+
+void start_event_loop() {
+    WAKE_FD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    get_console_size(WIDTH, HEIGHT);
+    // Keys are read a byte at a time, so poll sees every key not read yet
+    // instead of some waiting in the stdio buffer.
+    setvbuf(stdin, nullptr, _IONBF, 0);
+
+    struct sigaction action = {};
+    action.sa_handler = on_resize;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &action, nullptr);
+}
+
+void wake_event_loop() {
+    if (WAKE_FD < 0) return;
+    uint64_t one = 1;
+    write(WAKE_FD, &one, sizeof(one));
+}
+
+unsigned wait_for_event(int fd) {
+    pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0},
+                     {WAKE_FD, POLLIN, 0},
+                     {fd, POLLIN, 0}};
+    while (true) {
+        if (RESIZED) {
+            RESIZED = 0;
+            get_console_size(WIDTH, HEIGHT);
+            NEXT_FRAME = event_clock::now() + FRAME_INTERVAL;
+            return EVENT_RESIZE;
+        }
+
+        // Negative descriptors are skipped by ppoll, which holds back the
+        // wakeups until the frame is over.
+        event_clock::time_point now = event_clock::now();
+        bool hold = now < NEXT_FRAME;
+        fds[1].fd = hold ? -1 : WAKE_FD;
+        fds[2].fd = hold ? -1 : fd;
+        timespec timeout = {};
+        if (hold) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            NEXT_FRAME - now)
+                            .count();
+            timeout.tv_sec = left / 1000000000;
+            timeout.tv_nsec = left % 1000000000;
+        }
+        int ready = ppoll(fds, 3, hold ? &timeout : nullptr, nullptr);
+        if (ready < 0 && errno != EINTR) return 0;
+        if (ready <= 0) continue;
+
+        unsigned events = 0;
+        if (fds[0].revents != 0) events |= EVENT_INPUT;
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            read(WAKE_FD, &count, sizeof(count));
+            events |= EVENT_WAKE;
+        }
+        if (fds[2].revents != 0) events |= EVENT_WAKE;
+        // A resize is reported first, the redraw it causes shows whatever
+        // else came in.
+        if (RESIZED || events == 0) continue;
+        NEXT_FRAME = event_clock::now() + FRAME_INTERVAL;
+        return events;
+    }
+}
+
+void screen_size(int &width, int &height) {
+    width = WIDTH;
+    height = HEIGHT;
+}
@@ -0,0 +1,23 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+// What ended a wait_for_event, or-ed together.
+enum event_flags : unsigned {
+    EVENT_INPUT = 1,   // stdin has a key to read
+    EVENT_RESIZE = 2,  // the terminal changed size
+    EVENT_WAKE = 4,    // a background thread or the extra fd has news
+};
+
+// Sets up the wakeups and the SIGWINCH handler and reads the terminal size.
+// Called once, before the threads that wake the loop are started.
+void start_event_loop();
+// Tells the UI thread that something it shows changed. Safe from any thread
+// and cheap, wakeups before the UI gets to them are merged.
+void wake_event_loop();
+// Blocks until one of the events, with no timeout. fd, when given, is
+// watched for input as well. Wakeups within a frame of the previous return
+// are held back until the frame is over, keys never are.
+unsigned wait_for_event(int fd = -1);
+// The terminal size as of the last resize.
+void screen_size(int &width, int &height);
+#endif
@@ -0,0 +1,174 @@
+#include "fetch.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "event_loop.h"
+
+// Output kept per fetch, git only writes a few lines unless it fails.
+static const size_t MAX_OUTPUT = 64 * 1024;
+// How often exited children are looked for while their pipes stay quiet.
+static const int REAP_INTERVAL_MS = 50;
+
+fetch_options fetch_options_from_env() {
+    fetch_options options;
+    const char *jobs = std::getenv("PROJECTS_FETCH_JOBS");
+    if (jobs != nullptr) options.jobs = std::strtoul(jobs, nullptr, 10);
+    const char *timeout = std::getenv("PROJECTS_FETCH_TIMEOUT");
+    if (timeout != nullptr) {
+        int seconds = std::atoi(timeout);
+        if (seconds > 0) options.timeout_seconds = seconds;
+    }
+    return options;
+}
+
+fetch_scheduler::fetch_scheduler(std::vector<std::string> paths,
+                                 const fetch_options &options)
+    : paths(std::move(paths)), options(options) {
+    result_list.resize(this->paths.size());
+    for (size_t i = 0; i < this->paths.size(); i++) {
+        result_list[i].path = this->paths[i];
+    }
+}
+
+fetch_scheduler::~fetch_scheduler() {
+    cancel();
+    if (thread.joinable()) thread.join();
+    if (wake_fd >= 0) close(wake_fd);
+}
+
+void fetch_scheduler::start() {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        is_finished = true;
+        return;
+    }
+    thread = std::thread(&fetch_scheduler::run, this);
+}
+
+void fetch_scheduler::cancel() {
+    cancelled = true;
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
+        write(wake_fd, &one, sizeof(one));
+    }
+}
+
+std::vector<fetch_result> fetch_scheduler::results() {
+    std::lock_guard<std::mutex> guard(lock);
+    return result_list;
+}
+
+bool fetch_scheduler::spawn(size_t index, job &started) {
+    // Prompts for credentials or host keys would wait forever on a terminal
+    // nobody is looking at, so they fail instead. Every fetch gets a process
+    // group of its own, so a timeout also takes down the ssh or http helper
+    // git started.
+    process_options fetch;
+    fetch.argv = {"git", "fetch"};
+    fetch.directory = paths[index];
+    fetch.env = {"GIT_TERMINAL_PROMPT=0"};
+    if (std::getenv("GIT_SSH_COMMAND") == nullptr) {
+        fetch.env.push_back("GIT_SSH_COMMAND=ssh -o BatchMode=yes");
+    }
+    fetch.merge_output = true;
+    fetch.max_output = MAX_OUTPUT;
+    fetch.own_group = true;
+    fetch.timeout_ms = options.timeout_seconds * 1000;
+
+    started.index = index;
+    if (!started.process.start(fetch)) {
+        std::lock_guard<std::mutex> guard(lock);
+        result_list[index].output = started.process.error();
+        return false;
+    }
+    return true;
+}
+
+void fetch_scheduler::finish(job &running) {
+    const subprocess &process = running.process;
+    bool failed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        fetch_result &result = result_list[running.index];
+        result.output = process.out();
+        result.exit_code = process.exit_code();
+        result.timed_out = process.timed_out();
+        result.ok = result.exit_code == 0 && !result.timed_out &&
+                    !result.cancelled;
+        failed = !result.ok && !result.cancelled;
+    }
+    if (failed) failed_count++;
+    done_count++;
+    running_count--;
+    wake_event_loop();
+}
+
+void fetch_scheduler::run() {
+    unsigned int jobs = options.jobs;
+    if (jobs == 0) jobs = std::thread::hardware_concurrency();
+    if (jobs == 0) jobs = 1;
+
+    std::vector<job> active;
+    size_t next = 0;
+    bool killed = false;
+    while (true) {
+        size_t started_before = next;
+        while (!cancelled && active.size() < jobs && next < paths.size()) {
+            job started;
+            size_t index = next++;
+            running_count++;
+            if (spawn(index, started)) {
+                active.push_back(std::move(started));
+            } else {
+                running_count--;
+                failed_count++;
+                done_count++;
+            }
+        }
+        if (next != started_before) wake_event_loop();
+
+        if (cancelled && !killed) {
+            killed = true;
+            std::lock_guard<std::mutex> guard(lock);
+            for (auto &running : active) {
+                result_list[running.index].cancelled = true;
+                running.process.kill();
+            }
+            for (size_t i = next; i < paths.size(); i++) {
+                result_list[i].cancelled = true;
+            }
+        }
+        if (active.empty() && (cancelled || next >= paths.size())) break;
+
+        int timeout = REAP_INTERVAL_MS;
+        std::vector<pollfd> fds = {{wake_fd, POLLIN, 0}};
+        for (const auto &running : active) {
+            int left = running.process.timeout_left();
+            if (left >= 0) timeout = std::min(timeout, left);
+            running.process.add_poll_fds(fds);
+        }
+
+        poll(fds.data(), fds.size(), timeout);
+        if (fds[0].revents & POLLIN) {
+            uint64_t value;
+            read(wake_fd, &value, sizeof(value));
+        }
+
+        for (size_t i = 0; i < active.size();) {
+            if (active[i].process.update()) {
+                finish(active[i]);
+                active.erase(active.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    is_finished = true;
+    wake_event_loop();
+}
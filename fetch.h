@@ -0,0 +1,78 @@
+#ifndef FETCH_H
+#define FETCH_H
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "subprocess.h"
+
+struct fetch_options {
+    // Fetches running at once, 0 picks the hardware concurrency.
+    unsigned int jobs = 0;
+    // A fetch still running after this long is killed.
+    int timeout_seconds = 120;
+};
+
+struct fetch_result {
+    std::string path;
+    bool ok = false;
+    bool timed_out = false;
+    bool cancelled = false;
+    int exit_code = -1;
+    // What git wrote to stdout and stderr.
+    std::string output;
+};
+
+fetch_options fetch_options_from_env();
+
+// Runs `git fetch` in every given repository, a bounded number at a time, on
+// a thread of its own. The counters can be read from any thread while it
+// runs.
+class fetch_scheduler {
+   public:
+    fetch_scheduler(std::vector<std::string> paths,
+                    const fetch_options &options);
+    // Cancels what is still running and waits for it.
+    ~fetch_scheduler();
+
+    void start();
+    // Kills the running fetches and skips the ones not started yet.
+    void cancel();
+
+    size_t total() const { return paths.size(); }
+    size_t running() const { return running_count; }
+    size_t done() const { return done_count; }
+    size_t failed() const { return failed_count; }
+    bool finished() const { return is_finished; }
+
+    // One result per path, in the order the paths were given. Only complete
+    // once finished() returns true.
+    std::vector<fetch_result> results();
+
+   private:
+    struct job {
+        size_t index;
+        subprocess process;
+    };
+
+    const std::vector<std::string> paths;
+    const fetch_options options;
+    int wake_fd = -1;
+    std::thread thread;
+
+    std::atomic<bool> cancelled = false;
+    std::atomic<size_t> running_count = 0;
+    std::atomic<size_t> done_count = 0;
+    std::atomic<size_t> failed_count = 0;
+    std::atomic<bool> is_finished = false;
+
+    std::mutex lock;
+    std::vector<fetch_result> result_list;
+
+    void run();
+    bool spawn(size_t index, job &started);
+    void finish(job &running);
+};
+#endif
@@ -0,0 +1,390 @@
+#include "file_tree.h"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include "event_loop.h"
+#include "git_repository.h"
+
+// How long expand waits for a directory before leaving it to the background
+// thread and showing it as loading.
+static const auto SYNC_READ = std::chrono::milliseconds(20);
+// Changes to the entries of a directory. Writes only matter to .gitignore
+// files, the others are dropped when they are read.
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+
+file_tree::file_tree(const std::string &root)
+    : root(root),
+      root_fd(open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)),
+      flags(1, 0),
+      inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      node_watch(1, -1) {
+    thread = std::thread(&file_tree::run, this);
+    expand_node(0);
+}
+
+file_tree::~file_tree() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+    if (root_fd >= 0) close(root_fd);
+    if (inotify_fd >= 0) close(inotify_fd);
+}
+
+size_t file_tree::memory() const {
+    return sizeof(*this) + nodes.memory() + flags.capacity() +
+           node_watch.capacity() * sizeof(int) +
+           rows.capacity() * sizeof(visible_row);
+}
+
+tree_row file_tree::at(size_t row) const {
+    uint32_t node = rows[row].node;
+    return {nodes.name(node), rows[row].depth, nodes.is_dir(node),
+            (flags[node] & EXPANDED) != 0, (flags[node] & LOADING) != 0};
+}
+
+std::string file_tree::path(size_t row) const {
+    return root + "/" + nodes.path(rows[row].node);
+}
+
+void file_tree::expand_node(uint32_t node) {
+    if (!nodes.is_dir(node) || (flags[node] & EXPANDED)) return;
+    flags[node] |= EXPANDED;
+    if (flags[node] & (LOADED | LOADING)) {
+        update_rows();
+        return;
+    }
+
+    // The listing is added by the next apply, which also keeps the cursor in
+    // place should other directories come in with it.
+    flags[node] |= LOADING;
+    std::unique_lock<std::mutex> guard(lock);
+    queue.emplace_back(node, nodes.path(node));
+    wake.notify_one();
+    read.wait_for(guard, SYNC_READ, [this, node] {
+        return std::any_of(done.begin(), done.end(),
+                           [node](const listing &l) { return l.node == node; });
+    });
+}
+
+void file_tree::expand(size_t row) { expand_node(rows[row].node); }
+
+void file_tree::collapse(size_t row) {
+    uint32_t node = rows[row].node;
+    if (!(flags[node] & EXPANDED)) return;
+    flags[node] &= ~EXPANDED;
+    update_rows();
+}
+
+int file_tree::parent_row(size_t row) const {
+    uint32_t parent = nodes.parent(rows[row].node);
+    for (int i = static_cast<int>(row) - 1; i >= 0; i--) {
+        if (rows[i].node == parent) return i;
+    }
+    return -1;
+}
+
+bool file_tree::apply(int &cursor) {
+    handle_events();
+    std::vector<listing> results;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        results.swap(done);
+    }
+    if (results.empty()) return false;
+
+    bool tracked = cursor >= 0 && static_cast<size_t>(cursor) < rows.size();
+    uint32_t selected = tracked ? rows[cursor].node : 0;
+    moved.clear();
+    for (auto &result : results) add_children(result);
+    update_rows();
+    if (tracked) {
+        auto it = moved.find(selected);
+        if (it != moved.end()) selected = it->second;
+        size_t row = std::find_if(rows.begin(), rows.end(),
+                                  [selected](const visible_row &r) {
+                                      return r.node == selected;
+                                  }) -
+                     rows.begin();
+        // A removed node leaves the cursor where it was.
+        if (row < rows.size()) {
+            cursor = row;
+        } else {
+            cursor = std::min(cursor, static_cast<int>(rows.size()) - 1);
+        }
+    }
+    // Every reload leaves the old children behind, so a directory that
+    // keeps changing would grow the table for as long as it is cached.
+    if (dropped * 2 > nodes.size()) compact();
+    return true;
+}
+
+void file_tree::add_children(const listing &result) {
+    uint32_t node = result.node;
+    if (flags[node] & DROPPED) return;
+    bool reload = flags[node] & LOADED;
+    flags[node] = (flags[node] & ~(LOADING | STALE)) | LOADED;
+    if (node_watch[node] < 0) watch(node);
+    // Read again with nothing changed, as when a file came and went.
+    if (reload && nodes.same_children(node, result.entries)) return;
+    uint32_t old_first = nodes.first_child(node);
+    uint32_t old_count = nodes.child_count(node);
+
+    uint32_t first = nodes.add_children(node, result.entries);
+    flags.resize(nodes.size(), 0);
+    node_watch.resize(nodes.size(), -1);
+    if (!reload) return;
+
+    // Entries that are still there keep what was expanded below them.
+    // Names are interned, so equal names are equal pointers.
+    std::unordered_map<const char *, uint32_t> fresh;
+    for (uint32_t i = first; i < nodes.size(); i++) {
+        fresh[nodes.name(i)] = i;
+    }
+    for (uint32_t old = old_first; old < old_first + old_count; old++) {
+        auto it = fresh.find(nodes.name(old));
+        if (it == fresh.end() || nodes.type(it->second) != nodes.type(old)) {
+            drop(old);
+            continue;
+        }
+        uint32_t child = it->second;
+        nodes.move_children(old, child);
+        flags[child] = flags[old];
+        int wd = node_watch[old];
+        if (wd >= 0) {
+            std::vector<uint32_t> &targets = watched[wd];
+            std::replace(targets.begin(), targets.end(), old, child);
+            node_watch[child] = wd;
+            node_watch[old] = -1;
+        }
+        // A read still queued for the old node is skipped, so it is queued
+        // again for the new one.
+        bool pending = flags[old] & (STALE | LOADING);
+        flags[old] = DROPPED;
+        dropped++;
+        moved[old] = child;
+        if (pending) {
+            std::lock_guard<std::mutex> guard(lock);
+            queue.emplace_back(child, nodes.path(child));
+            wake.notify_one();
+        }
+    }
+}
+
+void file_tree::drop(uint32_t node) {
+    std::vector<uint32_t> stack = {node};
+    while (!stack.empty()) {
+        uint32_t item = stack.back();
+        stack.pop_back();
+        unwatch(item);
+        flags[item] = DROPPED;
+        dropped++;
+        uint32_t first = nodes.first_child(item);
+        for (uint32_t i = 0; i < nodes.child_count(item); i++) {
+            stack.push_back(first + i);
+        }
+    }
+}
+
+void file_tree::compact() {
+    std::vector<uint32_t> remap = nodes.compact();
+    std::vector<uint8_t> kept_flags(nodes.size(), 0);
+    std::vector<int> kept_watch(nodes.size(), -1);
+    for (uint32_t old = 0; old < remap.size(); old++) {
+        if (remap[old] == node_table::NONE) continue;
+        kept_flags[remap[old]] = flags[old];
+        kept_watch[remap[old]] = node_watch[old];
+    }
+    flags.swap(kept_flags);
+    node_watch.swap(kept_watch);
+    dropped = 0;
+    for (auto &[wd, targets] : watched) {
+        for (uint32_t &node : targets) node = remap[node];
+    }
+    for (visible_row &row : rows) row.node = remap[row.node];
+
+    // Reads of dropped nodes would be skipped anyway.
+    std::lock_guard<std::mutex> guard(lock);
+    std::deque<std::pair<uint32_t, std::string>> kept_queue;
+    for (auto &[node, dir] : queue) {
+        if (remap[node] != node_table::NONE) {
+            kept_queue.emplace_back(remap[node], std::move(dir));
+        }
+    }
+    queue.swap(kept_queue);
+    std::vector<listing> kept_done;
+    for (listing &result : done) {
+        if (remap[result.node] == node_table::NONE) continue;
+        result.node = remap[result.node];
+        kept_done.push_back(std::move(result));
+    }
+    done.swap(kept_done);
+    if (reading != node_table::NONE) reading = remap[reading];
+}
+
+void file_tree::watch(uint32_t node) {
+    if (inotify_fd < 0) return;
+    std::string dir = root + "/" + nodes.path(node);
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MASK);
+    if (wd < 0) return;
+    node_watch[node] = wd;
+    watched[wd].push_back(node);
+}
+
+void file_tree::unwatch(uint32_t node) {
+    int wd = node_watch[node];
+    if (wd < 0) return;
+    node_watch[node] = -1;
+    std::vector<uint32_t> &targets = watched[wd];
+    targets.erase(std::remove(targets.begin(), targets.end(), node),
+                  targets.end());
+    if (targets.empty()) {
+        watched.erase(wd);
+        inotify_rm_watch(inotify_fd, wd);
+    }
+}
+
+void file_tree::refresh(uint32_t node, bool subtree) {
+    std::vector<uint32_t> stack = {node};
+    std::lock_guard<std::mutex> guard(lock);
+    while (!stack.empty()) {
+        uint32_t item = stack.back();
+        stack.pop_back();
+        if (!(flags[item] & LOADED) || (flags[item] & (STALE | DROPPED))) {
+            continue;
+        }
+        flags[item] |= STALE;
+        queue.emplace_back(item, nodes.path(item));
+        if (!subtree) continue;
+        uint32_t first = nodes.first_child(item);
+        for (uint32_t i = 0; i < nodes.child_count(item); i++) {
+            if (nodes.is_dir(first + i)) stack.push_back(first + i);
+        }
+    }
+    wake.notify_one();
+}
+
+// Events of the trees that are not shown wait in the inotify queue until
+// they are opened again. Should it overflow, everything is read again.
+void file_tree::handle_events() {
+    if (inotify_fd < 0) return;
+    alignas(inotify_event) char
+        buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+    ssize_t length;
+    while ((length = ::read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + length;) {
+            const inotify_event *event =
+                reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                refresh(0, true);
+                std::lock_guard<std::mutex> guard(lock);
+                reset_ignore = true;
+                continue;
+            }
+            auto it = watched.find(event->wd);
+            if (it == watched.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                for (uint32_t node : it->second) node_watch[node] = -1;
+                watched.erase(it);
+                continue;
+            }
+
+            // What a .gitignore leaves out can change anywhere below it.
+            bool ignore_file =
+                event->len > 0 && strcmp(event->name, ".gitignore") == 0;
+            if ((event->mask & IN_CLOSE_WRITE) && !ignore_file) continue;
+            if (ignore_file) {
+                std::lock_guard<std::mutex> guard(lock);
+                reset_ignore = true;
+            }
+            for (uint32_t node : it->second) refresh(node, ignore_file);
+        }
+    }
+}
+
+void file_tree::update_rows() {
+    rows.clear();
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+    while (!stack.empty()) {
+        auto &[node, next] = stack.back();
+        if (next == nodes.child_count(node)) {
+            stack.pop_back();
+            continue;
+        }
+        uint32_t child = nodes.first_child(node) + next++;
+        rows.push_back({child, static_cast<int>(stack.size()) - 1});
+        if (flags[child] & EXPANDED) stack.push_back({child, 0});
+    }
+}
+
+dir_batch file_tree::read_directory(const std::string &dir) {
+    dir_batch entries;
+    int fd = openat(root_fd, dir.empty() ? "." : dir.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return entries;
+
+    // What git ignores is left out, so ignored directories are never read.
+    if (!ignore) {
+        git_repository repo(root);
+        ignore = std::make_unique<gitignore>(
+            repo.path(), repo.is_open() ? excludes_file(repo) : "");
+    }
+    ignore->move_to(root, dir);
+    std::string path = dir.empty() ? "" : dir + "/";
+    size_t base = path.size();
+
+    dir_reader reader(fd);
+    const char *name;
+    unsigned char d_type;
+    while (reader.next(name, d_type)) {
+        if (strcmp(name, ".git") == 0) continue;
+        // Links to directories can be expanded like the directories.
+        node_type type = entry_type(fd, name, d_type, true);
+        path.resize(base);
+        path += name;
+        if (!ignore->ignored(path, type == node_type::directory)) {
+            entries.add(name, type);
+        }
+    }
+    close(fd);
+    entries.sort();
+    return entries;
+}
+
+void file_tree::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+        auto [node, dir] = std::move(queue.front());
+        queue.pop_front();
+        reading = node;
+        if (reset_ignore) {
+            ignore.reset();
+            reset_ignore = false;
+        }
+
+        guard.unlock();
+        dir_batch entries = read_directory(dir);
+        guard.lock();
+
+        if (reading != node_table::NONE) {
+            done.push_back({reading, std::move(entries)});
+        }
+        reading = node_table::NONE;
+        read.notify_all();
+        wake_event_loop();
+    }
+}
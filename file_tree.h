@@ -0,0 +1,119 @@
+#ifndef FILE_TREE_H
+#define FILE_TREE_H
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "gitignore.h"
+#include "tree_walker.h"
+
+struct tree_row {
+    const char *name;
+    int depth;
+    bool is_dir;
+    bool expanded;
+    // Set while the children are read in the background.
+    bool loading;
+};
+
+// The files of a project as project_menu shows them, without the ones git
+// ignores. Directories start collapsed and are read when first expanded. A
+// directory that takes longer than a frame to read is finished on a
+// background thread, apply picks it up. Directories that were read are
+// watched with inotify and read again once they change.
+class file_tree {
+   public:
+    explicit file_tree(const std::string &root);
+    ~file_tree();
+    file_tree(const file_tree &) = delete;
+    file_tree &operator=(const file_tree &) = delete;
+
+    // Adds the directories read in the background since the last call and
+    // queues the ones that changed on disk. cursor, a row or -1, is moved
+    // along with its node. Returns true when the rows changed.
+    bool apply(int &cursor);
+    // Readable once something in the tree changed on disk, for the UI to
+    // wait on. apply reads it.
+    int watch_fd() const { return inotify_fd; }
+    // Bytes held by the nodes and rows.
+    size_t memory() const;
+
+    // Rows of the expanded part of the tree, without the root itself.
+    size_t size() const { return rows.size(); }
+    tree_row at(size_t row) const;
+    std::string path(size_t row) const;
+
+    void expand(size_t row);
+    void collapse(size_t row);
+    // The row of the directory holding row, -1 for the root.
+    int parent_row(size_t row) const;
+
+   private:
+    struct listing {
+        uint32_t node;
+        dir_batch entries;
+    };
+    struct visible_row {
+        uint32_t node;
+        int depth;
+    };
+    enum : uint8_t {
+        EXPANDED = 1,
+        LOADING = 2,
+        LOADED = 4,
+        // Changed on disk, read again.
+        STALE = 8,
+        // Removed, or replaced by a node of a later read.
+        DROPPED = 16,
+    };
+
+    const std::string root;
+    int root_fd;
+    node_table nodes;
+    // One set of the flags above per node.
+    std::vector<uint8_t> flags;
+    std::vector<visible_row> rows;
+    // Nodes marked DROPPED, left in the table until it is compacted.
+    size_t dropped = 0;
+
+    int inotify_fd;
+    // The watch of each node, -1 when there is none. A directory reached
+    // through a link shares its watch with the directory itself.
+    std::vector<int> node_watch;
+    std::unordered_map<int, std::vector<uint32_t>> watched;
+    // Nodes replaced by the apply running, to move the cursor along.
+    std::unordered_map<uint32_t, uint32_t> moved;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable read;
+    // Directories to read, relative to the root.
+    std::deque<std::pair<uint32_t, std::string>> queue;
+    // The node the reader is on, renumbered along with the queue.
+    uint32_t reading = node_table::NONE;
+    std::vector<listing> done;
+    bool stopping = false;
+    // Set when a .gitignore changed, the reader starts over with the files.
+    bool reset_ignore = false;
+    std::thread thread;
+    // Only used by the reader thread.
+    std::unique_ptr<gitignore> ignore;
+
+    void run();
+    dir_batch read_directory(const std::string &dir);
+    void expand_node(uint32_t node);
+    void add_children(const listing &result);
+    void update_rows();
+    void handle_events();
+    void refresh(uint32_t node, bool subtree);
+    void watch(uint32_t node);
+    void unwatch(uint32_t node);
+    void drop(uint32_t node);
+    void compact();
+};
+#endif
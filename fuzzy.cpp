@@ -0,0 +1,227 @@
+#include "fuzzy.h"
+
+#include <algorithm>
+#include <cctype>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const int SCORE_MATCH = 16;
+static const int GAP_START = -3;
+static const int GAP_EXTENSION = -1;
+static const int BONUS_SEPARATOR = 9;  // after '/'
+static const int BONUS_BOUNDARY = 8;
+static const int BONUS_CAMEL = 7;
+static const int BONUS_CONSECUTIVE = 4;
+// The first query character counts its bonus this many times over.
+static const int FIRST_MULTIPLIER = 2;
+
+static void fold_case(const char *from, size_t size, char *to) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i shift = _mm_set1_epi8('a' - 'A');
+    for (; i + 16 <= size; i += 16) {
+        __m128i chars =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(from + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chars, before_a),
+                                      _mm_cmplt_epi8(chars, after_z));
+        chars = _mm_add_epi8(chars, _mm_and_si128(upper, shift));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(to + i), chars);
+    }
+#endif
+    for (; i < size; i++) {
+        to[i] = (from[i] >= 'A' && from[i] <= 'Z') ? from[i] + ('a' - 'A')
+                                                   : from[i];
+    }
+}
+
+static const char *find_byte(const char *p, const char *end, char c) {
+#ifdef __SSE2__
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int hits = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, needle));
+        if (hits != 0) return p + __builtin_ctz(hits);
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == c) return p;
+    }
+    return nullptr;
+}
+
+// One bit per letter and digit, the rest of the characters share the
+// remaining bits.
+static uint64_t char_bit(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1ull << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ull << (26 + c - '0');
+    return 1ull << (36 + c % 28);
+}
+
+static uint64_t char_mask(const char *text, size_t size) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < size; i++) {
+        mask |= char_bit(text[i]);
+    }
+    return mask;
+}
+
+static std::string fold_query(const std::string &query) {
+    std::string folded(query.size(), '\0');
+    fold_case(query.data(), query.size(), folded.data());
+    return folded;
+}
+
+static int bonus_at(const char *text, size_t i) {
+    if (i == 0) return BONUS_BOUNDARY;
+    unsigned char previous = text[i - 1], current = text[i];
+    if (previous == '/') return BONUS_SEPARATOR;
+    if (!isalnum(previous) && isalnum(current)) return BONUS_BOUNDARY;
+    if (islower(previous) && isupper(current)) return BONUS_CAMEL;
+    return 0;
+}
+
+void fuzzy_finder::add(const std::string &candidate) {
+    size_t start = text.size();
+    text += candidate;
+    folded.resize(text.size());
+    fold_case(candidate.data(), candidate.size(), folded.data() + start);
+    offsets.push_back(text.size());
+    masks.push_back(char_mask(folded.data() + start, candidate.size()));
+    narrowed = false;
+}
+
+void fuzzy_finder::clear() {
+    text.clear();
+    folded.clear();
+    offsets = {0};
+    masks.clear();
+    last_query.clear();
+    narrowed = false;
+    survivors.clear();
+    results.clear();
+}
+
+std::string fuzzy_finder::at(uint32_t index) const {
+    return text.substr(offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+// The fzf v1 algorithm: the first match going forward, then going back from
+// where it ended to the latest start, which gives a short window that is
+// scored left to right.
+bool fuzzy_finder::score(uint32_t index, const std::string &query,
+                         int &total, int *found) const {
+    const char *begin = folded.data() + offsets[index];
+    const char *end = folded.data() + offsets[index + 1];
+    const char *p = begin;
+    for (char c : query) {
+        p = find_byte(p, end, c);
+        if (p == nullptr) return false;
+        p++;
+    }
+    if (query.empty()) {
+        total = 0;
+        return true;
+    }
+
+    size_t last = p - begin - 1;
+    size_t start = last;
+    for (size_t q = query.size(); q > 0; start--) {
+        if (begin[start] == query[q - 1] && --q == 0) break;
+    }
+
+    const char *original = text.data() + offsets[index];
+    total = 0;
+    size_t q = 0;
+    int consecutive = 0;
+    int chunk_bonus = 0;
+    bool in_gap = false;
+    for (size_t i = start; i <= last; i++) {
+        if (q < query.size() && begin[i] == query[q]) {
+            // A run of matches keeps the bonus of the character it
+            // started on.
+            int bonus = bonus_at(original, i);
+            if (consecutive == 0) {
+                chunk_bonus = bonus;
+            } else {
+                bonus = std::max({bonus, chunk_bonus, BONUS_CONSECUTIVE});
+            }
+            total += SCORE_MATCH + (q == 0 ? bonus * FIRST_MULTIPLIER : bonus);
+            if (found != nullptr) found[q] = i;
+            q++;
+            consecutive++;
+            in_gap = false;
+        } else {
+            total += in_gap ? GAP_EXTENSION : GAP_START;
+            consecutive = 0;
+            in_gap = true;
+        }
+    }
+    return true;
+}
+
+const std::vector<fuzzy_match> &fuzzy_finder::search(const std::string &query,
+                                                     size_t limit) {
+    std::string folded_query = fold_query(query);
+    if (folded_query.empty()) {
+        // Nothing to rank, the candidates are shown in the order given.
+        survivors.resize(size());
+        results.clear();
+        for (uint32_t index = 0; index < size(); index++) {
+            survivors[index] = index;
+            if (index < limit) results.push_back({index, 0});
+        }
+        last_query.clear();
+        narrowed = true;
+        return results;
+    }
+    bool narrowing = narrowed && folded_query.size() >= last_query.size() &&
+                     folded_query.compare(0, last_query.size(), last_query) ==
+                         0;
+    uint64_t query_mask = char_mask(folded_query.data(), folded_query.size());
+
+    std::vector<fuzzy_match> matches;
+    std::vector<uint32_t> kept;
+    auto consider = [&](uint32_t index) {
+        if ((masks[index] & query_mask) != query_mask) return;
+        int total;
+        if (!score(index, folded_query, total, nullptr)) return;
+        kept.push_back(index);
+        matches.push_back({index, total});
+    };
+    if (narrowing) {
+        for (uint32_t index : survivors) consider(index);
+    } else {
+        for (uint32_t index = 0; index < size(); index++) consider(index);
+    }
+    survivors.swap(kept);
+    last_query = folded_query;
+    narrowed = true;
+
+    // Only the rows that are shown get sorted.
+    auto better = [this](const fuzzy_match &a, const fuzzy_match &b) {
+        if (a.score != b.score) return a.score > b.score;
+        uint32_t a_size = offsets[a.index + 1] - offsets[a.index];
+        uint32_t b_size = offsets[b.index + 1] - offsets[b.index];
+        if (a_size != b_size) return a_size < b_size;
+        return a.index < b.index;
+    };
+    size_t shown = std::min(limit, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + shown, matches.end(),
+                      better);
+    matches.resize(shown);
+    results.swap(matches);
+    return results;
+}
+
+std::vector<int> fuzzy_finder::positions(uint32_t index,
+                                         const std::string &query) const {
+    std::string folded_query = fold_query(query);
+    std::vector<int> found(folded_query.size());
+    int total;
+    if (!score(index, folded_query, total, found.data())) found.clear();
+    return found;
+}
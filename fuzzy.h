@@ -0,0 +1,51 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct fuzzy_match {
+    uint32_t index;
+    int score;
+};
+
+// Scores candidates against a query the way fzf does: every query character
+// has to appear in order, matches at the start of words and right after each
+// other score higher and gaps cost. Case is ignored.
+class fuzzy_finder {
+   public:
+    void add(const std::string &candidate);
+    void clear();
+    size_t size() const { return masks.size(); }
+    std::string at(uint32_t index) const;
+
+    // The best matches for query, at most limit of them, best first. A query
+    // that extends the previous one only looks at what matched that one.
+    const std::vector<fuzzy_match> &search(const std::string &query,
+                                           size_t limit);
+    // Number of candidates that matched the last search.
+    size_t matched() const { return survivors.size(); }
+    // Where the characters of query landed in candidate index, for
+    // highlighting. Empty when it does not match.
+    std::vector<int> positions(uint32_t index, const std::string &query) const;
+
+   private:
+    // Candidates back to back, as given and lower cased, the last offset is
+    // the end of the final one.
+    std::string text;
+    std::string folded;
+    std::vector<uint32_t> offsets = {0};
+    // The characters each candidate holds, so most are ruled out without
+    // being read.
+    std::vector<uint64_t> masks;
+
+    std::string last_query;
+    bool narrowed = false;
+    std::vector<uint32_t> survivors;
+    std::vector<fuzzy_match> results;
+
+    bool score(uint32_t index, const std::string &query, int &total,
+               int *found) const;
+};
+#endif
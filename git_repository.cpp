@@ -0,0 +1,882 @@
+#include "git_repository.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+bool object_id::operator==(const object_id &other) const {
+    return memcmp(hash, other.hash, sizeof(hash)) == 0;
+}
+
+bool object_id::is_null() const {
+    for (unsigned char byte : hash) {
+        if (byte != 0) return false;
+    }
+    return true;
+}
+
+std::string object_id::hex() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string result(40, '0');
+    for (size_t i = 0; i < sizeof(hash); i++) {
+        result[i * 2] = digits[hash[i] >> 4];
+        result[i * 2 + 1] = digits[hash[i] & 15];
+    }
+    return result;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool object_id::from_hex(const std::string &hex, object_id &id) {
+    if (hex.size() < 40) return false;
+    for (size_t i = 0; i < sizeof(id.hash); i++) {
+        int high = hex_value(hex[i * 2]);
+        int low = hex_value(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) return false;
+        id.hash[i] = high << 4 | low;
+    }
+    return true;
+}
+
+size_t object_id_hash::operator()(const object_id &id) const {
+    size_t value;
+    memcpy(&value, id.hash, sizeof(value));
+    return value;
+}
+
+namespace {
+
+class sha1 {
+   public:
+    void update(const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        length += size;
+        while (size > 0) {
+            size_t take = std::min(size, sizeof(block) - used);
+            memcpy(block + used, bytes, take);
+            used += take;
+            bytes += take;
+            size -= take;
+            if (used == sizeof(block)) {
+                transform();
+                used = 0;
+            }
+        }
+    }
+
+    object_id finish() {
+        uint64_t bits = length * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != 56) update(&pad, 1);
+        unsigned char size[8];
+        for (int i = 0; i < 8; i++) size[i] = bits >> (56 - i * 8);
+        update(size, sizeof(size));
+
+        object_id id;
+        for (int i = 0; i < 20; i++) id.hash[i] = state[i / 4] >> (24 - (i % 4) * 8);
+        return id;
+    }
+
+   private:
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                         0xc3d2e1f0};
+    unsigned char block[64];
+    size_t used = 0;
+    uint64_t length = 0;
+
+    static uint32_t rotate(uint32_t value, int bits) {
+        return value << bits | value >> (32 - bits);
+    }
+
+    void transform() {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = block[i * 4] << 24 | block[i * 4 + 1] << 16 |
+                   block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+                 e = state[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t next = rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotate(b, 30);
+            b = a;
+            a = next;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+};
+
+uint32_t read_be32(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+bool read_file(const std::string &path, std::string &data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    data = contents.str();
+    return true;
+}
+
+std::string first_line(const std::string &data) {
+    std::string line = data.substr(0, data.find('\n'));
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+        line.pop_back();
+    }
+    return line;
+}
+
+// Inflates a zlib stream. When size is known the output must match it
+// exactly, otherwise the stream is read to its end.
+bool inflate_data(const unsigned char *input, size_t input_size,
+                  std::string &output, size_t size, bool size_known) {
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK) return false;
+    stream.next_in = const_cast<unsigned char *>(input);
+    stream.avail_in = input_size;
+
+    output.resize(size_known ? size : 4096);
+    size_t produced = 0;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (produced == output.size()) {
+            if (size_known) {
+                // Anything past the expected size is corrupt.
+                char extra;
+                stream.next_out = reinterpret_cast<unsigned char *>(&extra);
+                stream.avail_out = 1;
+                status = inflate(&stream, Z_FINISH);
+                if (stream.avail_out == 0) status = Z_DATA_ERROR;
+                break;
+            }
+            output.resize(output.size() * 2);
+        }
+        stream.next_out =
+            reinterpret_cast<unsigned char *>(&output[0]) + produced;
+        stream.avail_out = output.size() - produced;
+        status = inflate(&stream, Z_NO_FLUSH);
+        produced = output.size() - stream.avail_out;
+        if (status == Z_BUF_ERROR && stream.avail_in > 0) status = Z_OK;
+    }
+    inflateEnd(&stream);
+    output.resize(produced);
+    return status == Z_STREAM_END && (!size_known || produced == size);
+}
+
+size_t delta_size(const unsigned char *&p, const unsigned char *end) {
+    size_t size = 0;
+    int shift = 0;
+    while (p < end) {
+        unsigned char c = *p++;
+        size |= static_cast<size_t>(c & 0x7f) << shift;
+        shift += 7;
+        if (!(c & 0x80)) break;
+    }
+    return size;
+}
+
+bool apply_delta(const std::string &base, const std::string &delta,
+                 std::string &result) {
+    const unsigned char *p =
+        reinterpret_cast<const unsigned char *>(delta.data());
+    const unsigned char *end = p + delta.size();
+    if (delta_size(p, end) != base.size()) return false;
+    size_t size = delta_size(p, end);
+
+    result.clear();
+    result.reserve(size);
+    while (p < end) {
+        unsigned char op = *p++;
+        if (op & 0x80) {
+            size_t offset = 0, length = 0;
+            for (int i = 0; i < 4; i++) {
+                if (op & (1 << i)) {
+                    if (p == end) return false;
+                    offset |= static_cast<size_t>(*p++) << (i * 8);
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                if (op & (0x10 << i)) {
+                    if (p == end) return false;
+                    length |= static_cast<size_t>(*p++) << (i * 8);
+                }
+            }
+            if (length == 0) length = 0x10000;
+            if (offset + length > base.size()) return false;
+            result.append(base, offset, length);
+        } else if (op != 0) {
+            if (static_cast<size_t>(end - p) < op) return false;
+            result.append(reinterpret_cast<const char *>(p), op);
+            p += op;
+        } else {
+            return false;
+        }
+    }
+    return result.size() == size;
+}
+
+const char *type_name(int type) {
+    switch (type) {
+        case 1:
+            return "commit";
+        case 2:
+            return "tree";
+        case 3:
+            return "blob";
+        case 4:
+            return "tag";
+        default:
+            return "";
+    }
+}
+
+const int OFS_DELTA = 6;
+const int REF_DELTA = 7;
+
+struct mapped_file {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                data = static_cast<const unsigned char *>(map);
+                size = st.st_size;
+            }
+        }
+        close(fd);
+        return data != nullptr;
+    }
+
+    ~mapped_file() {
+        if (data != nullptr) munmap(const_cast<unsigned char *>(data), size);
+    }
+};
+
+}  // namespace
+
+// A pack and its version 2 index, both mapped.
+class pack_file {
+   public:
+    bool open(const std::string &idx_path) {
+        if (!idx.open(idx_path) || idx.size < 8 + 256 * 4 + 40) return false;
+        if (memcmp(idx.data, "\377tOc", 4) != 0 || read_be32(idx.data + 4) != 2) {
+            return false;
+        }
+        count = read_be32(idx.data + 8 + 255 * 4);
+        if (idx.size < 8 + 256 * 4 + count * 28 + 40) return false;
+
+        std::string pack_path = idx_path.substr(0, idx_path.size() - 4) + ".pack";
+        return pack.open(pack_path) && pack.size >= 32 &&
+               memcmp(pack.data, "PACK", 4) == 0;
+    }
+
+    bool find(const object_id &id, uint64_t &offset) const {
+        const unsigned char *fanout = idx.data + 8;
+        uint32_t low = id.hash[0] == 0 ? 0 : read_be32(fanout + (id.hash[0] - 1) * 4);
+        uint32_t high = read_be32(fanout + id.hash[0] * 4);
+        const unsigned char *ids = fanout + 256 * 4;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            int order = memcmp(ids + middle * 20, id.hash, 20);
+            if (order == 0) {
+                offset = entry_offset(middle);
+                return true;
+            }
+            if (order < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return false;
+    }
+
+    // Reads the object at offset. Deltas are returned as they are, with the
+    // location of their base.
+    bool read(uint64_t offset, int &type, std::string &data,
+              uint64_t &base_offset, object_id &base_id) const {
+        if (offset >= pack.size) return false;
+        const unsigned char *p = pack.data + offset;
+        const unsigned char *end = pack.data + pack.size;
+
+        unsigned char c = *p++;
+        type = (c >> 4) & 7;
+        size_t size = c & 15;
+        int shift = 4;
+        while (c & 0x80) {
+            if (p == end) return false;
+            c = *p++;
+            size |= static_cast<size_t>(c & 0x7f) << shift;
+            shift += 7;
+        }
+
+        if (type == OFS_DELTA) {
+            if (p == end) return false;
+            c = *p++;
+            uint64_t distance = c & 0x7f;
+            while (c & 0x80) {
+                if (p == end) return false;
+                c = *p++;
+                distance = ((distance + 1) << 7) | (c & 0x7f);
+            }
+            if (distance > offset) return false;
+            base_offset = offset - distance;
+        } else if (type == REF_DELTA) {
+            if (end - p < 20) return false;
+            memcpy(base_id.hash, p, 20);
+            p += 20;
+        }
+        return inflate_data(p, end - p, data, size, true);
+    }
+
+   private:
+    mapped_file idx;
+    mapped_file pack;
+    uint32_t count = 0;
+
+    uint64_t entry_offset(uint32_t index) const {
+        const unsigned char *offsets = idx.data + 8 + 256 * 4 + count * 24;
+        uint32_t offset = read_be32(offsets + index * 4);
+        if (!(offset & 0x80000000)) return offset;
+
+        // Packs over 2 GiB keep the large offsets in a table of their own.
+        const unsigned char *large =
+            offsets + count * 4 + (offset & 0x7fffffff) * 8;
+        if (large + 8 > idx.data + idx.size) return UINT64_MAX;
+        return static_cast<uint64_t>(read_be32(large)) << 32 |
+               read_be32(large + 4);
+    }
+};
+
+bool find_git_dir(const std::string &work_tree, std::string &git_dir,
+                  std::string &common_dir) {
+    std::string dot_git = work_tree + "/.git";
+    struct stat st;
+    if (stat(dot_git.c_str(), &st) != 0) return false;
+    std::string dir = dot_git;
+    if (S_ISREG(st.st_mode)) {
+        // Worktrees and submodules point to their git directory.
+        std::string contents;
+        if (!read_file(dot_git, contents)) return false;
+        std::string line = first_line(contents);
+        if (line.compare(0, 8, "gitdir: ") != 0) return false;
+        dir = line.substr(8);
+        if (dir.empty()) return false;
+        if (dir[0] != '/') dir = work_tree + "/" + dir;
+    }
+
+    std::string common = dir;
+    std::string contents;
+    if (read_file(dir + "/commondir", contents)) {
+        common = first_line(contents);
+        if (!common.empty() && common[0] != '/') common = dir + "/" + common;
+    }
+    git_dir = dir;
+    common_dir = common;
+    return true;
+}
+
+git_repository::git_repository(const std::string &work_tree)
+    : root(work_tree) {
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+
+    std::string dir, common;
+    if (!find_git_dir(root, dir, common)) return;
+
+    const char *home = std::getenv("HOME");
+    const char *xdg = std::getenv("XDG_CONFIG_HOME");
+    load_config("/etc/gitconfig");
+    if (xdg != nullptr && xdg[0] != '\0') {
+        load_config(std::string(xdg) + "/git/config");
+    } else if (home != nullptr) {
+        load_config(std::string(home) + "/.config/git/config");
+    }
+    if (home != nullptr) load_config(std::string(home) + "/.gitconfig");
+    load_config(common + "/config");
+
+    // Other hash functions and ref backends are not handled here.
+    const std::string *format = config("extensions.objectformat");
+    const std::string *refs = config("extensions.refstorage");
+    if ((format != nullptr && *format != "sha1") ||
+        (refs != nullptr && *refs != "files") ||
+        config_bool("extensions.worktreeconfig", false)) {
+        return;
+    }
+
+    git_dir = dir;
+    common_dir = common;
+}
+
+git_repository::~git_repository() = default;
+
+static std::string config_value(const std::string &text) {
+    std::string value;
+    bool quoted = false;
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos) return value;
+    for (size_t i = start; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == '\\' && i + 1 < text.size()) {
+            char next = text[++i];
+            value += next == 'n' ? '\n' : next == 't' ? '\t' : next;
+        } else if ((c == '#' || c == ';') && !quoted) {
+            break;
+        } else {
+            value += c;
+        }
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.pop_back();
+    }
+    return value;
+}
+
+void git_repository::load_config(const std::string &file) {
+    std::ifstream input(file);
+    std::string line, section;
+    while (std::getline(input, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos) continue;
+        line.erase(0, start);
+        if (line[0] == '#' || line[0] == ';') continue;
+
+        if (line[0] == '[') {
+            size_t end = line.find(']');
+            if (end == std::string::npos) continue;
+            std::string header = line.substr(1, end - 1);
+            size_t quote = header.find('"');
+            std::string name = header.substr(0, quote);
+            while (!name.empty() && name.back() == ' ') name.pop_back();
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            section = name;
+            if (quote != std::string::npos) {
+                size_t close = header.rfind('"');
+                if (close > quote) {
+                    section += "." + header.substr(quote + 1, close - quote - 1);
+                }
+            }
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        std::string key = line.substr(0, equals);
+        while (!key.empty() && (key.back() == ' ' || key.back() == '\t')) {
+            key.pop_back();
+        }
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        values[section + "." + key] =
+            equals == std::string::npos ? "true"
+                                        : config_value(line.substr(equals + 1));
+    }
+}
+
+const std::string *git_repository::config(const std::string &key) const {
+    auto it = values.find(key);
+    return it == values.end() ? nullptr : &it->second;
+}
+
+bool git_repository::config_bool(const std::string &key, bool fallback) const {
+    const std::string *value = config(key);
+    if (value == nullptr) return fallback;
+    std::string lower = *value;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower == "true" || lower == "yes" || lower == "on" || lower == "1") {
+        return true;
+    }
+    if (lower == "false" || lower == "no" || lower == "off" || lower == "0" ||
+        lower.empty()) {
+        return false;
+    }
+    return fallback;
+}
+
+bool git_repository::head(std::string &branch) const {
+    std::string contents;
+    if (!read_file(git_dir + "/HEAD", contents)) return false;
+    std::string line = first_line(contents);
+    branch.clear();
+    if (line.compare(0, 5, "ref: ") == 0) {
+        branch = line.substr(5);
+        if (branch.compare(0, 11, "refs/heads/") == 0) branch.erase(0, 11);
+        return true;
+    }
+    object_id id;
+    return object_id::from_hex(line, id);
+}
+
+bool git_repository::resolve_ref(const std::string &ref, object_id &id) const {
+    std::string name = ref;
+    for (int depth = 0; depth < 5; depth++) {
+        // HEAD and the other pseudo refs live in the worktree's own
+        // directory, everything under refs/ is shared.
+        bool shared = name.compare(0, 5, "refs/") == 0;
+        std::string contents;
+        if (read_file((shared ? common_dir : git_dir) + "/" + name, contents)) {
+            std::string line = first_line(contents);
+            if (line.compare(0, 5, "ref: ") == 0) {
+                name = line.substr(5);
+                continue;
+            }
+            return object_id::from_hex(line, id);
+        }
+
+        std::ifstream packed(common_dir + "/packed-refs");
+        std::string line;
+        while (std::getline(packed, line)) {
+            if (line.empty() || line[0] == '#' || line[0] == '^') continue;
+            if (line.size() == 41 + name.size() &&
+                line.compare(41, std::string::npos, name) == 0) {
+                return object_id::from_hex(line, id);
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+bool git_repository::read_loose(const object_id &id, std::string &type,
+                                std::string &data) {
+    std::string hex = id.hex();
+    std::string compressed;
+    if (!read_file(common_dir + "/objects/" + hex.substr(0, 2) + "/" +
+                       hex.substr(2),
+                   compressed)) {
+        return false;
+    }
+
+    std::string raw;
+    if (!inflate_data(reinterpret_cast<const unsigned char *>(compressed.data()),
+                      compressed.size(), raw, 0, false)) {
+        return false;
+    }
+    size_t space = raw.find(' ');
+    size_t nul = raw.find('\0');
+    if (space == std::string::npos || nul == std::string::npos || space > nul) {
+        return false;
+    }
+    type = raw.substr(0, space);
+    if (std::strtoull(raw.c_str() + space + 1, nullptr, 10) !=
+        raw.size() - nul - 1) {
+        return false;
+    }
+    data = raw.substr(nul + 1);
+    return true;
+}
+
+void git_repository::load_packs() {
+    packs_loaded = true;
+    std::string dir = common_dir + "/objects/pack";
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr) return;
+    while (const dirent *entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".idx") != 0) {
+            continue;
+        }
+        auto pack = std::make_unique<pack_file>();
+        if (pack->open(dir + "/" + name)) packs.push_back(std::move(pack));
+    }
+    closedir(handle);
+}
+
+bool git_repository::read_packed(const object_id &id, std::string &type,
+                                 std::string &data) {
+    if (!packs_loaded) load_packs();
+
+    for (const auto &pack : packs) {
+        uint64_t offset;
+        if (!pack->find(id, offset)) continue;
+
+        // Walk down the delta chain to its base, then apply the deltas on
+        // the way back up.
+        std::vector<std::string> deltas;
+        int kind;
+        std::string object;
+        while (true) {
+            uint64_t base_offset = 0;
+            object_id base_id;
+            std::string payload;
+            if (deltas.size() > 4096 ||
+                !pack->read(offset, kind, payload, base_offset, base_id)) {
+                return false;
+            }
+            if (kind == OFS_DELTA) {
+                deltas.push_back(std::move(payload));
+                offset = base_offset;
+            } else if (kind == REF_DELTA) {
+                deltas.push_back(std::move(payload));
+                std::string base_type;
+                if (!read_object(base_id, base_type, object)) return false;
+                type = base_type;
+                break;
+            } else {
+                type = type_name(kind);
+                object = std::move(payload);
+                break;
+            }
+        }
+        if (type.empty()) return false;
+
+        for (auto delta = deltas.rbegin(); delta != deltas.rend(); delta++) {
+            std::string result;
+            if (!apply_delta(object, *delta, result)) return false;
+            object = std::move(result);
+        }
+        data = std::move(object);
+        return true;
+    }
+    return false;
+}
+
+bool git_repository::read_object(const object_id &id, std::string &type,
+                                 std::string &data) {
+    return read_packed(id, type, data) || read_loose(id, type, data);
+}
+
+bool git_repository::read_commit(const object_id &id, commit_info &commit) {
+    std::string type, data;
+    if (!read_object(id, type, data) || type != "commit") return false;
+
+    commit = commit_info();
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = data.find('\n', pos);
+        if (end == std::string::npos || end == pos) break;
+        std::string line = data.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (line.compare(0, 5, "tree ") == 0) {
+            if (!object_id::from_hex(line.substr(5), commit.tree)) return false;
+        } else if (line.compare(0, 7, "parent ") == 0) {
+            object_id parent;
+            if (!object_id::from_hex(line.substr(7), parent)) return false;
+            commit.parents.push_back(parent);
+        } else if (line.compare(0, 10, "committer ") == 0) {
+            size_t email = line.rfind('>');
+            if (email != std::string::npos) {
+                commit.time = std::strtoll(line.c_str() + email + 1, nullptr, 10);
+            }
+        }
+    }
+    return true;
+}
+
+bool git_repository::read_tree(const object_id &id,
+                               std::vector<tree_entry> &entries) {
+    std::string type, data;
+    if (!read_object(id, type, data) || type != "tree") return false;
+
+    entries.clear();
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t space = data.find(' ', pos);
+        size_t nul = data.find('\0', pos);
+        if (space == std::string::npos || nul == std::string::npos ||
+            space > nul || nul + 21 > data.size()) {
+            return false;
+        }
+        tree_entry entry;
+        entry.mode = std::strtoul(data.c_str() + pos, nullptr, 8);
+        entry.name = data.substr(space + 1, nul - space - 1);
+        memcpy(entry.id.hash, data.data() + nul + 1, 20);
+        entries.push_back(std::move(entry));
+        pos = nul + 21;
+    }
+    return true;
+}
+
+// Cache tree entries are stored depth first, every directory followed by its
+// subdirectories.
+static bool parse_cache_tree(const unsigned char *&p, const unsigned char *end,
+                             const std::string &parent, git_index &index) {
+    const unsigned char *nul =
+        static_cast<const unsigned char *>(memchr(p, '\0', end - p));
+    if (nul == nullptr) return false;
+    std::string name(reinterpret_cast<const char *>(p), nul - p);
+    p = nul + 1;
+
+    char *next;
+    long count = std::strtol(reinterpret_cast<const char *>(p), &next, 10);
+    long subtrees = std::strtol(next, &next, 10);
+    p = reinterpret_cast<const unsigned char *>(next);
+    if (p >= end || *p != '\n') return false;
+    p++;
+
+    cache_tree_entry entry = {static_cast<int>(count), {}};
+    if (count >= 0) {
+        if (end - p < 20) return false;
+        memcpy(entry.id.hash, p, 20);
+        p += 20;
+    }
+    std::string path = parent.empty() ? name : parent + "/" + name;
+    index.trees[path] = entry;
+
+    for (long i = 0; i < subtrees; i++) {
+        if (!parse_cache_tree(p, end, path, index)) return false;
+    }
+    return true;
+}
+
+bool git_repository::read_index(git_index &index) const {
+    std::string path = git_dir + "/index";
+    std::string file;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !read_file(path, file)) {
+        // A repository without an index has nothing staged yet.
+        index = git_index();
+        return access(path.c_str(), F_OK) != 0;
+    }
+    index = git_index();
+    index.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                  st.st_mtim.tv_nsec;
+
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(file.data());
+    const unsigned char *end = data + file.size();
+    if (file.size() < 12 + 20 || memcmp(data, "DIRC", 4) != 0) return false;
+    uint32_t version = read_be32(data + 4);
+    uint32_t count = read_be32(data + 8);
+    if (version < 2 || version > 4) return false;
+    end -= 20;
+
+    const unsigned char *p = data + 12;
+    index.entries.reserve(count);
+    std::string previous;
+    for (uint32_t i = 0; i < count; i++) {
+        const unsigned char *start = p;
+        if (end - p < 62) return false;
+        index_entry entry;
+        entry.ctime_sec = read_be32(p);
+        entry.ctime_nsec = read_be32(p + 4);
+        entry.mtime_sec = read_be32(p + 8);
+        entry.mtime_nsec = read_be32(p + 12);
+        entry.dev = read_be32(p + 16);
+        entry.ino = read_be32(p + 20);
+        entry.mode = read_be32(p + 24);
+        entry.uid = read_be32(p + 28);
+        entry.gid = read_be32(p + 32);
+        entry.size = read_be32(p + 36);
+        memcpy(entry.id.hash, p + 40, 20);
+        entry.flags = p[60] << 8 | p[61];
+        entry.extended_flags = 0;
+        p += 62;
+        if (entry.flags & 0x4000) {
+            if (version < 3 || end - p < 2) return false;
+            entry.extended_flags = p[0] << 8 | p[1];
+            p += 2;
+        }
+
+        if (version == 4) {
+            // Names are stored as the number of bytes to drop from the end
+            // of the previous name, followed by the new suffix.
+            if (p >= end) return false;
+            unsigned char c = *p++;
+            size_t strip = c & 0x7f;
+            while (c & 0x80) {
+                if (p >= end) return false;
+                c = *p++;
+                strip = ((strip + 1) << 7) | (c & 0x7f);
+            }
+            if (strip > previous.size()) return false;
+            const unsigned char *nul =
+                static_cast<const unsigned char *>(memchr(p, '\0', end - p));
+            if (nul == nullptr) return false;
+            entry.path = previous.substr(0, previous.size() - strip);
+            entry.path.append(reinterpret_cast<const char *>(p), nul - p);
+            p = nul + 1;
+        } else {
+            const unsigned char *nul =
+                static_cast<const unsigned char *>(memchr(p, '\0', end - p));
+            if (nul == nullptr) return false;
+            entry.path.assign(reinterpret_cast<const char *>(p), nul - p);
+            // Entries are padded with NULs to a multiple of eight bytes.
+            size_t length = (nul - start + 8) & ~static_cast<size_t>(7);
+            p = start + length;
+            if (p > end) return false;
+        }
+        previous = entry.path;
+        index.entries.push_back(std::move(entry));
+    }
+
+    while (end - p >= 8) {
+        const unsigned char *signature = p;
+        uint32_t size = read_be32(p + 4);
+        p += 8;
+        if (static_cast<size_t>(end - p) < size) return false;
+        const unsigned char *extension_end = p + size;
+
+        if (memcmp(signature, "TREE", 4) == 0) {
+            const unsigned char *tree = p;
+            while (tree < extension_end) {
+                if (!parse_cache_tree(tree, extension_end, "", index)) {
+                    index.trees.clear();
+                    break;
+                }
+            }
+        } else if (memcmp(signature, "link", 4) == 0 ||
+                   memcmp(signature, "sdir", 4) == 0) {
+            index.partial = true;
+        } else if (signature[0] < 'A' || signature[0] > 'Z') {
+            // Lowercase extensions have to be understood to read the index.
+            return false;
+        }
+        p = extension_end;
+    }
+    return true;
+}
+
+object_id hash_blob(const std::string &data) {
+    sha1 hash;
+    std::string header = "blob " + std::to_string(data.size());
+    hash.update(header.c_str(), header.size() + 1);
+    hash.update(data.data(), data.size());
+    return hash.finish();
+}
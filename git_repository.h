@@ -0,0 +1,121 @@
+#ifndef GIT_REPOSITORY_H
+#define GIT_REPOSITORY_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct object_id {
+    unsigned char hash[20] = {};
+
+    bool operator==(const object_id &other) const;
+    bool operator!=(const object_id &other) const { return !(*this == other); }
+    bool is_null() const;
+    std::string hex() const;
+    static bool from_hex(const std::string &hex, object_id &id);
+};
+
+struct object_id_hash {
+    size_t operator()(const object_id &id) const;
+};
+
+struct index_entry {
+    uint32_t ctime_sec, ctime_nsec;
+    uint32_t mtime_sec, mtime_nsec;
+    uint32_t dev, ino, mode, uid, gid, size;
+    object_id id;
+    uint16_t flags;
+    uint16_t extended_flags;
+    std::string path;
+
+    int stage() const { return (flags >> 12) & 3; }
+    bool assume_valid() const { return flags & 0x8000; }
+    bool skip_worktree() const { return extended_flags & 0x4000; }
+    bool intent_to_add() const { return extended_flags & 0x2000; }
+};
+
+// A directory of the index's cache tree. entry_count is -1 once a change
+// below the directory invalidated the tree id.
+struct cache_tree_entry {
+    int entry_count;
+    object_id id;
+};
+
+struct git_index {
+    std::vector<index_entry> entries;
+    // Keyed by directory path, "" for the root.
+    std::unordered_map<std::string, cache_tree_entry> trees;
+    // Split and sparse indexes only hold part of the entries.
+    bool partial = false;
+    int64_t mtime = 0;  // nanoseconds
+};
+
+struct tree_entry {
+    uint32_t mode;
+    std::string name;
+    object_id id;
+};
+
+struct commit_info {
+    object_id tree;
+    std::vector<object_id> parents;
+    int64_t time = 0;
+};
+
+class pack_file;
+
+// Read-only access to a repository's refs, config, objects and index,
+// without running git. Reading fails rather than guessing when the
+// repository uses something not handled here, callers then fall back to the
+// git command line. Not thread safe.
+class git_repository {
+   public:
+    // Finds the git directory of work_tree, a .git directory or a .git file
+    // pointing to one.
+    explicit git_repository(const std::string &work_tree);
+    ~git_repository();
+
+    bool is_open() const { return !git_dir.empty(); }
+    const std::string &work_tree() const { return root; }
+    const std::string &path() const { return git_dir; }
+
+    // Config values keyed by lowercase "section.subsection.key", from the
+    // global config files overridden by the repository's own.
+    const std::string *config(const std::string &key) const;
+    bool config_bool(const std::string &key, bool fallback) const;
+
+    // The branch HEAD points to, empty when it is detached. Returns false when
+    // HEAD cannot be read.
+    bool head(std::string &branch) const;
+    // Resolves a full ref name such as "HEAD" or "refs/heads/main". Returns
+    // false when the ref does not exist.
+    bool resolve_ref(const std::string &ref, object_id &id) const;
+
+    bool read_object(const object_id &id, std::string &type, std::string &data);
+    bool read_commit(const object_id &id, commit_info &commit);
+    bool read_tree(const object_id &id, std::vector<tree_entry> &entries);
+
+    bool read_index(git_index &index) const;
+
+   private:
+    std::string root;
+    std::string git_dir;
+    std::string common_dir;
+    std::unordered_map<std::string, std::string> values;
+    std::vector<std::unique_ptr<pack_file>> packs;
+    bool packs_loaded = false;
+
+    void load_config(const std::string &file);
+    void load_packs();
+    bool read_loose(const object_id &id, std::string &type, std::string &data);
+    bool read_packed(const object_id &id, std::string &type, std::string &data);
+};
+
+// Finds the git directory of work_tree and the directory holding the refs and
+// objects it shares with other worktrees, the same one outside worktrees.
+bool find_git_dir(const std::string &work_tree, std::string &git_dir,
+                  std::string &common_dir);
+// The id git gives a blob with the given contents.
+object_id hash_blob(const std::string &data);
+#endif
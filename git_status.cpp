@@ -0,0 +1,815 @@
+#include "git_status.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+
+#include "git_repository.h"
+#include "gitignore.h"
+#include "subprocess.h"
+
+static const uint32_t TYPE_MASK = 0170000;
+static const uint32_t TYPE_FILE = 0100000;
+static const uint32_t TYPE_DIRECTORY = 0040000;
+static const uint32_t TYPE_SYMLINK = 0120000;
+static const uint32_t TYPE_GITLINK = 0160000;
+
+// Entries compared per thread, smaller indexes are compared on one thread.
+static const size_t ENTRIES_PER_THREAD = 1024;
+// Commits walked for ahead/behind before leaving it to git.
+static const size_t MAX_WALKED_COMMITS = 100000;
+
+// Quotes a path the way git's short format does.
+static std::string quote_path(const std::string &path, bool quote_high) {
+    bool needs_quotes = false;
+    for (unsigned char c : path) {
+        if (c < 0x20 || c == ' ' || c == '"' || c == '\\' || c == 0x7f ||
+            (c >= 0x80 && quote_high)) {
+            needs_quotes = true;
+            break;
+        }
+    }
+    if (!needs_quotes) return path;
+
+    std::string quoted = "\"";
+    for (unsigned char c : path) {
+        switch (c) {
+            case '\a': quoted += "\\a"; break;
+            case '\b': quoted += "\\b"; break;
+            case '\t': quoted += "\\t"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\v': quoted += "\\v"; break;
+            case '\f': quoted += "\\f"; break;
+            case '\r': quoted += "\\r"; break;
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            default:
+                if (c < 0x20 || c == 0x7f || (c >= 0x80 && quote_high)) {
+                    char octal[5];
+                    snprintf(octal, sizeof(octal), "\\%03o", c);
+                    quoted += octal;
+                } else {
+                    quoted += c;
+                }
+        }
+    }
+    return quoted + "\"";
+}
+
+// Counts the commits only reachable from local and only reachable from
+// upstream. Commits are visited newest first, a commit that turns out to be
+// reachable from the other side as well passes that on to its parents again.
+// The walk stops once every queued commit is reachable from both sides and
+// none is as new as a commit still counted for one side only.
+static bool count_divergence(git_repository &repo, const object_id &local,
+                             const object_id &upstream, int &ahead,
+                             int &behind) {
+    struct walk_state {
+        int flags = 0;
+        bool queued = false;
+        int64_t time = 0;
+        std::vector<object_id> parents;
+    };
+    struct queued_commit {
+        int64_t time;
+        object_id id;
+
+        bool operator<(const queued_commit &other) const {
+            return time < other.time;
+        }
+    };
+
+    std::unordered_map<object_id, walk_state, object_id_hash> states;
+    std::priority_queue<queued_commit> queue;
+    std::vector<object_id> one_sided;
+    size_t unresolved = 0;
+
+    auto push = [&](const object_id &id, int flags) {
+        auto [it, inserted] = states.try_emplace(id);
+        walk_state &state = it->second;
+        if (inserted) {
+            commit_info commit;
+            if (!repo.read_commit(id, commit)) return false;
+            state.time = commit.time;
+            state.parents = std::move(commit.parents);
+        } else if ((state.flags | flags) == state.flags) {
+            return true;
+        }
+
+        int old = state.flags;
+        state.flags |= flags;
+        if (state.queued) {
+            if (state.flags == 3) unresolved--;
+            return true;
+        }
+        if (old == 0 && state.flags != 3) one_sided.push_back(id);
+        state.queued = true;
+        if (state.flags != 3) unresolved++;
+        queue.push({state.time, id});
+        return true;
+    };
+
+    // Time of the newest commit only reached from one side so far.
+    auto newest_one_sided = [&]() {
+        int64_t newest = INT64_MIN;
+        for (const auto &id : one_sided) {
+            const walk_state &state = states[id];
+            if (state.flags != 3) newest = std::max(newest, state.time);
+        }
+        return newest;
+    };
+
+    if (!push(local, 1) || !push(upstream, 2)) return false;
+    size_t walked = 0;
+    while (!queue.empty() &&
+           (unresolved > 0 || queue.top().time >= newest_one_sided())) {
+        if (++walked > MAX_WALKED_COMMITS) return false;
+        object_id id = queue.top().id;
+        queue.pop();
+        walk_state &state = states[id];
+        state.queued = false;
+        if (state.flags != 3) unresolved--;
+        int flags = state.flags;
+        std::vector<object_id> parents = state.parents;
+        for (const auto &parent : parents) {
+            if (!push(parent, flags)) return false;
+        }
+    }
+
+    ahead = behind = 0;
+    for (const auto &id : one_sided) {
+        int flags = states[id].flags;
+        if (flags == 1) ahead++;
+        if (flags == 2) behind++;
+    }
+    return true;
+}
+
+static bool branch_line(git_repository &repo, std::string &line) {
+    std::string branch;
+    if (!repo.head(branch)) return false;
+    if (branch.empty()) {
+        line = "## HEAD (no branch)";
+        return true;
+    }
+
+    const std::string *remote = repo.config("branch." + branch + ".remote");
+    const std::string *merge = repo.config("branch." + branch + ".merge");
+    bool has_upstream = remote != nullptr && merge != nullptr;
+
+    object_id head;
+    if (!repo.resolve_ref("HEAD", head)) {
+        line = "## No commits yet on " + branch;
+        return !has_upstream;
+    }
+    line = "## " + branch;
+    if (!has_upstream) return true;
+    if (merge->compare(0, 11, "refs/heads/") != 0) return false;
+
+    std::string name = merge->substr(11);
+    std::string tracking, short_name;
+    if (*remote == ".") {
+        tracking = *merge;
+        short_name = name;
+    } else {
+        // Only the default refspec maps branches to refs/remotes/<remote>.
+        const std::string *fetch = repo.config("remote." + *remote + ".fetch");
+        if (fetch == nullptr ||
+            *fetch != "+refs/heads/*:refs/remotes/" + *remote + "/*") {
+            return false;
+        }
+        tracking = "refs/remotes/" + *remote + "/" + name;
+        short_name = *remote + "/" + name;
+    }
+    line += "..." + short_name;
+
+    object_id upstream;
+    if (!repo.resolve_ref(tracking, upstream)) {
+        line += " [gone]";
+        return true;
+    }
+    if (upstream == head) return true;
+
+    int ahead, behind;
+    if (!count_divergence(repo, head, upstream, ahead, behind)) return false;
+    if (ahead > 0 && behind > 0) {
+        line += " [ahead " + std::to_string(ahead) + ", behind " +
+                std::to_string(behind) + "]";
+    } else if (ahead > 0) {
+        line += " [ahead " + std::to_string(ahead) + "]";
+    } else if (behind > 0) {
+        line += " [behind " + std::to_string(behind) + "]";
+    }
+    return true;
+}
+
+struct head_file {
+    uint32_t mode;
+    object_id id;
+    bool seen = false;
+};
+
+// Collects the files of a HEAD tree, skipping the directories whose cache
+// tree id shows the index still matches them.
+static bool collect_head_files(
+    git_repository &repo, const git_index &index, const object_id &tree,
+    const std::string &prefix,
+    std::unordered_map<std::string, head_file> &files,
+    std::unordered_set<std::string> &unchanged_dirs) {
+    auto cached = index.trees.find(prefix);
+    if (cached != index.trees.end() && cached->second.entry_count >= 0 &&
+        cached->second.id == tree) {
+        unchanged_dirs.insert(prefix);
+        return true;
+    }
+
+    std::vector<tree_entry> entries;
+    if (!repo.read_tree(tree, entries)) return false;
+    for (const auto &entry : entries) {
+        std::string path = prefix.empty() ? entry.name : prefix + "/" + entry.name;
+        if ((entry.mode & TYPE_MASK) == TYPE_DIRECTORY) {
+            if (!collect_head_files(repo, index, entry.id, path, files,
+                                    unchanged_dirs)) {
+                return false;
+            }
+        } else {
+            files[path] = {entry.mode, entry.id};
+        }
+    }
+    return true;
+}
+
+static bool in_unchanged_dir(const std::string &path,
+                             const std::unordered_set<std::string> &dirs) {
+    if (dirs.empty()) return false;
+    size_t slash = path.size();
+    while ((slash = path.rfind('/', slash - 1)) != std::string::npos) {
+        if (dirs.count(path.substr(0, slash))) return true;
+        if (slash == 0) break;
+    }
+    return false;
+}
+
+// Files whose contents git would filter before hashing cannot be compared
+// here.
+static bool can_hash_contents(const git_repository &repo,
+                              const git_index &index) {
+    const std::string *autocrlf = repo.config("core.autocrlf");
+    if (autocrlf != nullptr && *autocrlf != "false") return false;
+    if (repo.config("core.attributesfile") != nullptr) return false;
+    if (access((repo.path() + "/info/attributes").c_str(), F_OK) == 0) {
+        return false;
+    }
+    const char *home = std::getenv("HOME");
+    const char *xdg = std::getenv("XDG_CONFIG_HOME");
+    std::string global =
+        xdg != nullptr && xdg[0] != '\0'
+            ? std::string(xdg) + "/git/attributes"
+            : std::string(home != nullptr ? home : "") + "/.config/git/attributes";
+    if (access(global.c_str(), F_OK) == 0) return false;
+
+    for (const auto &entry : index.entries) {
+        const std::string &path = entry.path;
+        if (path == ".gitattributes" ||
+            (path.size() > 15 &&
+             path.compare(path.size() - 15, 15, "/.gitattributes") == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_contents(const std::string &path, std::string &data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    data = contents.str();
+    return true;
+}
+
+struct worktree_check {
+    const git_repository &repo;
+    const git_index &index;
+    bool trust_mode;
+    bool can_hash;
+    std::atomic<bool> failed = false;
+};
+
+// The work tree column of one entry: ' ', 'M', 'D' or 'T'. Sets failed when
+// the entry cannot be compared here.
+static char compare_entry(worktree_check &check, const index_entry &entry) {
+    if (entry.assume_valid()) return ' ';
+
+    std::string path = check.repo.work_tree() + "/" + entry.path;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        if (errno == ENOENT || errno == ENOTDIR) return 'D';
+        check.failed = true;
+        return ' ';
+    }
+
+    uint32_t type = entry.mode & TYPE_MASK;
+    if (S_ISDIR(st.st_mode) || (type != TYPE_FILE && type != TYPE_SYMLINK)) {
+        check.failed = true;
+        return ' ';
+    }
+    if ((type == TYPE_FILE) != S_ISREG(st.st_mode)) return 'T';
+    if (type == TYPE_FILE && check.trust_mode &&
+        ((entry.mode & 0100) != 0) != ((st.st_mode & S_IXUSR) != 0)) {
+        return 'M';
+    }
+    uint32_t size = static_cast<uint32_t>(st.st_size);
+    // Racily clean entries are written with size 0, their contents decide.
+    if (entry.size != size && entry.size != 0) return 'M';
+
+    int64_t entry_mtime =
+        static_cast<int64_t>(entry.mtime_sec) * 1000000000 + entry.mtime_nsec;
+    bool racy = entry_mtime >= check.index.mtime;
+    bool stat_clean =
+        entry.size == size && entry.mtime_sec == (uint32_t)st.st_mtim.tv_sec &&
+        entry.mtime_nsec == (uint32_t)st.st_mtim.tv_nsec &&
+        entry.ctime_sec == (uint32_t)st.st_ctim.tv_sec &&
+        entry.ino == (uint32_t)st.st_ino && entry.uid == st.st_uid &&
+        entry.gid == st.st_gid;
+    if (stat_clean && !racy) return ' ';
+
+    if (!check.can_hash) {
+        check.failed = true;
+        return ' ';
+    }
+    std::string contents;
+    if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t length = readlink(path.c_str(), target, sizeof(target));
+        if (length < 0) {
+            check.failed = true;
+            return ' ';
+        }
+        contents.assign(target, length);
+    } else if (!read_contents(path, contents)) {
+        check.failed = true;
+        return ' ';
+    }
+    return hash_blob(contents) == entry.id ? ' ' : 'M';
+}
+
+// Threads to spread jobs over, threads of 0 picking the hardware concurrency.
+static size_t worker_count(unsigned int threads, size_t jobs) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return std::min<size_t>(std::max(threads, 1u), jobs);
+}
+
+static void compare_worktree(worktree_check &check, std::vector<char> &result,
+                             unsigned int threads) {
+    const auto &entries = check.index.entries;
+    result.assign(entries.size(), ' ');
+
+    auto compare_range = [&](size_t first, size_t last) {
+        for (size_t i = first; i < last && !check.failed; i++) {
+            result[i] = compare_entry(check, entries[i]);
+        }
+    };
+
+    size_t count =
+        worker_count(threads, entries.size() / ENTRIES_PER_THREAD + 1);
+    if (count <= 1) {
+        compare_range(0, entries.size());
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t chunk = (entries.size() + count - 1) / count;
+    for (size_t first = 0; first < entries.size(); first += chunk) {
+        workers.emplace_back(compare_range, first,
+                             std::min(first + chunk, entries.size()));
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+struct untracked_walk {
+    const std::string &root;
+    gitignore &ignore;
+    // Sorted by path, as the index keeps them.
+    const std::vector<index_entry> &tracked;
+    std::vector<std::string> &untracked;
+};
+
+static std::vector<index_entry>::const_iterator first_at_or_after(
+    const std::vector<index_entry> &entries, const std::string &path) {
+    return std::lower_bound(entries.begin(), entries.end(), path,
+                            [](const index_entry &entry, const std::string &key) {
+                                return entry.path < key;
+                            });
+}
+
+static bool is_tracked(const std::vector<index_entry> &entries,
+                       const std::string &path) {
+    auto it = first_at_or_after(entries, path);
+    return it != entries.end() && it->path == path;
+}
+
+static bool has_tracked_below(const std::vector<index_entry> &entries,
+                              const std::string &dir) {
+    std::string prefix = dir + "/";
+    auto it = first_at_or_after(entries, prefix);
+    return it != entries.end() &&
+           it->path.compare(0, prefix.size(), prefix) == 0;
+}
+
+static bool entry_is_dir(const std::string &path, const dirent *entry) {
+    if (entry->d_type == DT_DIR) return true;
+    if (entry->d_type != DT_UNKNOWN) return false;
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Whether an untracked directory holds anything git would list, in which
+// case git shows the directory instead of its contents.
+static bool has_untracked(untracked_walk &walk, const std::string &dir) {
+    std::string full = walk.root + "/" + dir;
+    DIR *handle = opendir(full.c_str());
+    if (handle == nullptr) return false;
+
+    walk.ignore.push_directory(walk.root, dir);
+    bool found = false;
+    while (const dirent *entry = readdir(handle)) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (strcmp(name, ".git") == 0) {
+            found = true;
+            break;
+        }
+        std::string path = dir + "/" + name;
+        bool is_dir = entry_is_dir(full + "/" + name, entry);
+        if (walk.ignore.ignored(path, is_dir)) continue;
+        if (!is_dir || has_untracked(walk, path)) {
+            found = true;
+            break;
+        }
+    }
+    walk.ignore.pop_directory();
+    closedir(handle);
+    return found;
+}
+
+static void find_untracked(untracked_walk &walk, const std::string &dir) {
+    std::string full = dir.empty() ? walk.root : walk.root + "/" + dir;
+    DIR *handle = opendir(full.c_str());
+    if (handle == nullptr) return;
+
+    walk.ignore.push_directory(walk.root, dir);
+    while (const dirent *entry = readdir(handle)) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, ".git") == 0) {
+            continue;
+        }
+        std::string path = dir.empty() ? name : dir + "/" + name;
+        bool is_dir = entry_is_dir(full + "/" + name, entry);
+        if (!is_dir) {
+            if (!is_tracked(walk.tracked, path) &&
+                !walk.ignore.ignored(path, false)) {
+                walk.untracked.push_back(path);
+            }
+            continue;
+        }
+
+        if (walk.ignore.ignored(path, true)) continue;
+        if (has_tracked_below(walk.tracked, path)) {
+            find_untracked(walk, path);
+        } else if (has_untracked(walk, path)) {
+            walk.untracked.push_back(path + "/");
+        }
+    }
+    walk.ignore.pop_directory();
+    closedir(handle);
+}
+
+bool read_git_status(const std::string &work_tree, std::string &status,
+                     unsigned int threads) {
+    git_repository repo(work_tree);
+    if (!repo.is_open()) return false;
+
+    const std::string *untracked_mode = repo.config("status.showuntrackedfiles");
+    if ((untracked_mode != nullptr && *untracked_mode != "normal") ||
+        repo.config_bool("core.ignorecase", false) ||
+        repo.config_bool("core.sparsecheckout", false) ||
+        !repo.config_bool("status.aheadbehind", true)) {
+        return false;
+    }
+
+    std::string branch;
+    if (!branch_line(repo, branch)) return false;
+
+    git_index index;
+    if (!repo.read_index(index) || index.partial) return false;
+    for (const auto &entry : index.entries) {
+        if (entry.stage() != 0 || entry.intent_to_add() ||
+            entry.skip_worktree() ||
+            (entry.mode & TYPE_MASK) == TYPE_GITLINK) {
+            return false;
+        }
+    }
+
+    // Index against HEAD, the first status column.
+    std::vector<char> staged(index.entries.size(), ' ');
+    std::unordered_map<std::string, head_file> head_files;
+    object_id head;
+    if (repo.resolve_ref("HEAD", head)) {
+        commit_info commit;
+        if (!repo.read_commit(head, commit)) return false;
+        std::unordered_set<std::string> unchanged_dirs;
+        if (!collect_head_files(repo, index, commit.tree, "", head_files,
+                                unchanged_dirs)) {
+            return false;
+        }
+        if (unchanged_dirs.count("") == 0) {
+            for (size_t i = 0; i < index.entries.size(); i++) {
+                const index_entry &entry = index.entries[i];
+                if (in_unchanged_dir(entry.path, unchanged_dirs)) continue;
+                auto file = head_files.find(entry.path);
+                if (file == head_files.end()) {
+                    staged[i] = 'A';
+                    continue;
+                }
+                file->second.seen = true;
+                if ((file->second.mode & TYPE_MASK) != (entry.mode & TYPE_MASK)) {
+                    staged[i] = 'T';
+                } else if (file->second.mode != entry.mode ||
+                           file->second.id != entry.id) {
+                    staged[i] = 'M';
+                }
+            }
+        }
+    } else {
+        std::fill(staged.begin(), staged.end(), 'A');
+    }
+
+    std::vector<std::pair<std::string, std::string>> changes;
+    for (const auto &[path, file] : head_files) {
+        if (!file.seen) {
+            changes.push_back({path, "D "});
+        }
+    }
+    // git pairs staged additions and deletions up as renames.
+    if (!changes.empty() &&
+        std::find(staged.begin(), staged.end(), 'A') != staged.end()) {
+        return false;
+    }
+
+    // Work tree against the index, the second column.
+    worktree_check check{repo, index, repo.config_bool("core.filemode", true),
+                         can_hash_contents(repo, index)};
+    std::vector<char> modified;
+    compare_worktree(check, modified, threads);
+    if (check.failed) return false;
+
+    for (size_t i = 0; i < index.entries.size(); i++) {
+        const std::string &path = index.entries[i].path;
+        if (staged[i] != ' ' || modified[i] != ' ') {
+            changes.push_back({path, std::string(1, staged[i]) + modified[i]});
+        }
+    }
+    std::sort(changes.begin(), changes.end());
+
+    gitignore ignore(repo.path(), excludes_file(repo));
+    std::vector<std::string> untracked;
+    untracked_walk walk{repo.work_tree(), ignore, index.entries, untracked};
+    find_untracked(walk, "");
+    std::sort(untracked.begin(), untracked.end());
+
+    bool quote_high = repo.config_bool("core.quotepath", true);
+    status = branch + "\n";
+    for (const auto &[path, columns] : changes) {
+        status += columns + " " + quote_path(path, quote_high) + "\n";
+    }
+    for (const auto &path : untracked) {
+        status += "?? " + quote_path(path, quote_high) + "\n";
+    }
+    return true;
+}
+
+std::string git_status(const std::string &work_tree, unsigned int threads) {
+    std::string result;
+    if (read_git_status(work_tree, result, threads)) return result;
+
+    // Status is read in the background, so git must not take index.lock
+    // away from whatever the user runs at the same time.
+    process_options status;
+    status.argv = {"git", "status", "-bs"};
+    status.directory = work_tree;
+    status.env = {"GIT_OPTIONAL_LOCKS=0"};
+    return run_process(status).out();
+}
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+
+static void hash_bytes(uint64_t &hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+}
+
+// Mixes what lstat says about path into an FNV-1a hash. A missing file
+// counts too, so creating it changes the hash.
+static void hash_stat(uint64_t &hash, const std::string &path) {
+    int64_t values[7] = {};
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        values[0] = st.st_mtim.tv_sec;
+        values[1] = st.st_mtim.tv_nsec;
+        values[2] = st.st_ctim.tv_sec;
+        values[3] = st.st_ctim.tv_nsec;
+        values[4] = st.st_size;
+        values[5] = st.st_ino;
+        values[6] = st.st_mode;
+    }
+    hash_bytes(hash, values, sizeof(values));
+}
+
+static void hash_string(uint64_t &hash, const std::string &text) {
+    for (unsigned char c : text) hash = (hash ^ c) * 0x100000001b3;
+    hash = (hash ^ 0xff) * 0x100000001b3;
+}
+
+// Refs are updated by renaming a new file into place, which changes the
+// modification time of the directory holding them.
+static void hash_ref_dirs(uint64_t &hash, const std::string &dir) {
+    hash_stat(hash, dir);
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr) return;
+    std::vector<std::string> subdirs;
+    while (dirent *entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        if (entry_is_dir(dir + "/" + name, entry)) subdirs.push_back(name);
+    }
+    closedir(handle);
+    std::sort(subdirs.begin(), subdirs.end());
+    for (const auto &name : subdirs) hash_ref_dirs(hash, dir + "/" + name);
+}
+
+// Hashes the tracked files in [first, last) and the directories holding
+// them. The blocks of the index are hashed on their own and combined in
+// order, so the result does not depend on the number of threads.
+static uint64_t hash_tracked(const std::string &work_tree,
+                             std::vector<index_entry>::const_iterator first,
+                             std::vector<index_entry>::const_iterator last) {
+    uint64_t hash = FNV_OFFSET;
+    std::string path = work_tree + "/";
+    size_t base = path.size();
+    std::string_view dir = "\n";  // matches no directory
+    for (auto it = first; it != last; ++it) {
+        path.resize(base);
+        path += it->path;
+        hash_stat(hash, path);
+        std::string_view parent = it->path;
+        size_t slash = parent.rfind('/');
+        parent = slash == std::string_view::npos ? "" : parent.substr(0, slash);
+        if (parent == dir || parent.empty()) continue;
+        dir = parent;
+        path.resize(base);
+        path += parent;
+        hash_stat(hash, path);
+    }
+    return hash;
+}
+
+static std::string to_hex(uint64_t hash) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx",
+             static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+std::string git_status_fingerprint(const std::string &work_tree, bool deep,
+                                   unsigned int threads) {
+    std::string git_dir, common_dir;
+    if (!find_git_dir(work_tree, git_dir, common_dir)) return "";
+
+    uint64_t hash = FNV_OFFSET;
+    for (const char *name : {"index", "HEAD", "FETCH_HEAD"}) {
+        hash_stat(hash, git_dir + "/" + name);
+    }
+    hash_stat(hash, common_dir + "/packed-refs");
+    std::string head;
+    std::ifstream head_file(git_dir + "/HEAD");
+    std::getline(head_file, head);
+    if (head.compare(0, 5, "ref: ") == 0) {
+        hash_stat(hash, common_dir + "/" + head.substr(5));
+    }
+    hash_stat(hash, work_tree);
+    std::string fingerprint = to_hex(hash);
+    if (!deep) return fingerprint;
+
+    hash = FNV_OFFSET;
+    for (const char *name : {"config", "info/exclude"}) {
+        hash_stat(hash, common_dir + "/" + name);
+    }
+    hash_ref_dirs(hash, common_dir + "/refs/heads");
+    hash_ref_dirs(hash, common_dir + "/refs/remotes");
+
+    // Every tracked file, which is what git stats first as well, and the
+    // directories holding them, where new untracked files show up. An index
+    // that cannot be read leaves nothing to compare against.
+    git_repository repo(work_tree);
+    git_index index;
+    if (!repo.read_index(index)) return "";
+    const auto &entries = index.entries;
+    size_t blocks = (entries.size() + ENTRIES_PER_THREAD - 1) /
+                    ENTRIES_PER_THREAD;
+    std::vector<uint64_t> block_hashes(blocks);
+    std::atomic<size_t> next = 0;
+    auto hash_blocks = [&] {
+        for (size_t block; (block = next++) < blocks;) {
+            size_t first = block * ENTRIES_PER_THREAD;
+            size_t last = std::min(first + ENTRIES_PER_THREAD, entries.size());
+            block_hashes[block] =
+                hash_tracked(work_tree, entries.begin() + first,
+                             entries.begin() + last);
+        }
+    };
+    std::vector<std::thread> workers;
+    size_t count = worker_count(threads, blocks);
+    for (size_t i = 1; i < count; i++) workers.emplace_back(hash_blocks);
+    hash_blocks();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    hash_bytes(hash, block_hashes.data(), blocks * sizeof(uint64_t));
+
+    // The entries of the top level, untracked ones included.
+    DIR *handle = opendir(work_tree.c_str());
+    if (handle != nullptr) {
+        std::vector<std::string> names;
+        while (dirent *entry = readdir(handle)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != ".." && name != ".git") {
+                names.push_back(name);
+            }
+        }
+        closedir(handle);
+        std::sort(names.begin(), names.end());
+        for (const auto &name : names) {
+            hash_string(hash, name);
+            hash_stat(hash, work_tree + "/" + name);
+        }
+    }
+
+    return fingerprint + "-" + to_hex(hash);
+}
+
+bool fingerprint_matches(const std::string &stored, const std::string &fresh) {
+    if (fresh.empty()) return false;
+    if (fresh.find('-') != std::string::npos) return stored == fresh;
+    return stored.compare(0, fresh.size(), fresh) == 0 &&
+           (stored.size() == fresh.size() || stored[fresh.size()] == '-');
+}
+
+git_summary summarize_git_status(const std::string &status) {
+    git_summary summary;
+    if (status.compare(0, 3, "## ") != 0) return summary;
+    summary.valid = true;
+
+    size_t end = status.find('\n');
+    std::string line = status.substr(3, end == std::string::npos
+                                            ? std::string::npos
+                                            : end - 3);
+    summary.dirty = end != std::string::npos && end + 1 < status.size();
+
+    const std::string unborn = "No commits yet on ";
+    if (line.compare(0, unborn.size(), unborn) == 0) line.erase(0, unborn.size());
+    if (line.compare(0, 16, "HEAD (no branch)") == 0) {
+        summary.branch = "HEAD";
+        return summary;
+    }
+    summary.branch = line.substr(0, std::min(line.find("..."), line.find(' ')));
+
+    size_t ahead = line.find("ahead ");
+    if (ahead != std::string::npos) {
+        summary.ahead = std::atoi(line.c_str() + ahead + 6);
+    }
+    size_t behind = line.find("behind ");
+    if (behind != std::string::npos) {
+        summary.behind = std::atoi(line.c_str() + behind + 7);
+    }
+    return summary;
+}
@@ -0,0 +1,38 @@
+#ifndef GIT_STATUS_H
+#define GIT_STATUS_H
+#include <string>
+
+// What the main menu shows of a repository's status.
+struct git_summary {
+    std::string branch;
+    bool dirty = false;
+    int ahead = 0;
+    int behind = 0;
+    // Whether the status could be read at all.
+    bool valid = false;
+};
+
+// The output of `git status -bs` for the repository at work_tree. It is
+// computed in process when possible and taken from git otherwise. The work
+// tree is compared on up to threads threads, 0 for the hardware concurrency.
+std::string git_status(const std::string &work_tree, unsigned int threads = 1);
+// Computes the status from HEAD, the refs and the index without running git.
+// Returns false for repositories this does not handle, such as sparse or
+// split indexes, submodules, conflicts and files with attributes that would
+// have to be filtered before comparing them.
+bool read_git_status(const std::string &work_tree, std::string &status,
+                     unsigned int threads = 1);
+git_summary summarize_git_status(const std::string &status);
+// Changes whenever the index, HEAD, the ref it points to, packed-refs,
+// FETCH_HEAD or the top level directory change, from a handful of lstat
+// calls, cheap enough to check every project on startup. With deep it also
+// covers the config, the refs, the entries of the top level, every tracked
+// file and every directory holding one, from one lstat each. Empty when
+// work_tree is not a repository or, with deep, its index cannot be read.
+// threads works as for git_status.
+std::string git_status_fingerprint(const std::string &work_tree, bool deep,
+                                   unsigned int threads = 1);
+// Whether a status taken at fingerprint stored is still current by fresh.
+// A fresh fingerprint taken without deep only checks the shallow part.
+bool fingerprint_matches(const std::string &stored, const std::string &fresh);
+#endif
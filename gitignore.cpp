@@ -0,0 +1,295 @@
+#include "gitignore.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "git_repository.h"
+
+// Picks the cheapest way to match a pattern. Escapes and character classes
+// are left to wildmatch.
+static void classify(ignore_pattern &pattern) {
+    const std::string &glob = pattern.glob;
+    auto plain = [](const std::string &text) {
+        return text.find_first_of("*?[\\") == std::string::npos;
+    };
+    if (plain(glob)) {
+        pattern.kind = match_kind::literal;
+        pattern.text = glob;
+    } else if (glob.size() > 1 && glob[0] == '*' && plain(glob.substr(1))) {
+        pattern.kind = match_kind::suffix;
+        pattern.text = glob.substr(1);
+    } else if (glob.size() > 1 && glob.back() == '*' &&
+               plain(glob.substr(0, glob.size() - 1))) {
+        pattern.kind = match_kind::prefix;
+        pattern.text = glob.substr(0, glob.size() - 1);
+    }
+}
+
+static bool match_pattern(const ignore_pattern &pattern, const char *subject,
+                          size_t length) {
+    const std::string &text = pattern.text;
+    size_t size = text.size();
+    switch (pattern.kind) {
+        case match_kind::literal:
+            return length == size && memcmp(subject, text.data(), size) == 0;
+        case match_kind::prefix:
+            // The '*' does not cross directories.
+            return length >= size &&
+                   memcmp(subject, text.data(), size) == 0 &&
+                   memchr(subject + size, '/', length - size) == nullptr;
+        case match_kind::suffix:
+            return length >= size &&
+                   memcmp(subject + length - size, text.data(), size) == 0 &&
+                   memchr(subject, '/', length - size) == nullptr;
+        default:
+            return wildmatch(pattern.glob.c_str(), subject);
+    }
+}
+
+static bool parse_pattern(std::string line, ignore_pattern &pattern) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') return false;
+
+    // Trailing spaces are dropped unless escaped with a backslash.
+    size_t end = line.size();
+    while (end > 0 && line[end - 1] == ' ' &&
+           !(end > 1 && line[end - 2] == '\\')) {
+        end--;
+    }
+    line.resize(end);
+
+    if (line[0] == '!') {
+        pattern.negated = true;
+        line.erase(0, 1);
+    } else if (line[0] == '\\' && line.size() > 1 &&
+               (line[1] == '!' || line[1] == '#')) {
+        line.erase(0, 1);
+    }
+    if (!line.empty() && line.back() == '/') {
+        pattern.directory_only = true;
+        line.pop_back();
+    }
+    if (line.empty()) return false;
+
+    if (line.find('/') != std::string::npos) {
+        pattern.anchored = true;
+        if (line[0] == '/') line.erase(0, 1);
+    }
+    pattern.glob = std::move(line);
+    classify(pattern);
+    return !pattern.glob.empty();
+}
+
+bool read_ignore_file(const std::string &file, ignore_list &list) {
+    std::ifstream input(file);
+    if (!input) return false;
+
+    std::string line;
+    while (std::getline(input, line)) {
+        ignore_pattern pattern;
+        if (parse_pattern(line, pattern)) {
+            list.patterns.push_back(std::move(pattern));
+        }
+    }
+
+    list.literals.clear();
+    list.others.clear();
+    for (size_t i = 0; i < list.patterns.size(); i++) {
+        const ignore_pattern &pattern = list.patterns[i];
+        if (pattern.kind == match_kind::literal && !pattern.anchored) {
+            ignore_list::last_literal &last = list.literals[pattern.text];
+            last.any = i;
+            if (!pattern.directory_only) last.file = i;
+        } else {
+            list.others.push_back(i);
+        }
+    }
+    return true;
+}
+
+std::string excludes_file(const git_repository &repo) {
+    const char *home = std::getenv("HOME");
+    const std::string *configured = repo.config("core.excludesfile");
+    if (configured != nullptr) {
+        if (configured->compare(0, 2, "~/") == 0 && home != nullptr) {
+            return home + configured->substr(1);
+        }
+        return *configured;
+    }
+    const char *xdg = std::getenv("XDG_CONFIG_HOME");
+    if (xdg != nullptr && xdg[0] != '\0') {
+        return std::string(xdg) + "/git/ignore";
+    }
+    if (home != nullptr) return std::string(home) + "/.config/git/ignore";
+    return "";
+}
+
+static bool match_class(const char *&pattern, char c) {
+    // pattern points just past the '['.
+    bool negated = *pattern == '!' || *pattern == '^';
+    if (negated) pattern++;
+
+    bool matched = false;
+    bool first = true;
+    while (*pattern != '\0' && (first || *pattern != ']')) {
+        first = false;
+        char low = *pattern++;
+        if (low == '\\' && *pattern != '\0') low = *pattern++;
+        char high = low;
+        if (*pattern == '-' && pattern[1] != ']' && pattern[1] != '\0') {
+            high = pattern[1];
+            pattern += 2;
+            if (high == '\\' && *pattern != '\0') high = *pattern++;
+        }
+        if (c >= low && c <= high) matched = true;
+    }
+    if (*pattern == ']') pattern++;
+    return matched != negated;
+}
+
+bool wildmatch(const char *pattern, const char *text) {
+    while (*pattern != '\0') {
+        switch (*pattern) {
+            case '*': {
+                bool double_star = pattern[1] == '*';
+                while (*pattern == '*') pattern++;
+                if (double_star) {
+                    // "**/" also matches no directory at all.
+                    if (*pattern == '/' &&
+                        wildmatch(pattern + 1, text)) {
+                        return true;
+                    }
+                    if (*pattern == '\0') return true;
+                    for (const char *rest = text; *rest != '\0'; rest++) {
+                        if (wildmatch(pattern, rest)) return true;
+                    }
+                    return false;
+                }
+                if (*pattern == '\0') {
+                    for (; *text != '\0'; text++) {
+                        if (*text == '/') return false;
+                    }
+                    return true;
+                }
+                for (const char *rest = text;; rest++) {
+                    if (wildmatch(pattern, rest)) return true;
+                    if (*rest == '\0' || *rest == '/') return false;
+                }
+            }
+            case '?':
+                if (*text == '\0' || *text == '/') return false;
+                pattern++;
+                text++;
+                break;
+            case '[':
+                if (*text == '\0' || *text == '/') return false;
+                pattern++;
+                if (!match_class(pattern, *text)) return false;
+                text++;
+                break;
+            case '\\':
+                if (pattern[1] != '\0') pattern++;
+                [[fallthrough]];
+            default:
+                if (*pattern != *text) return false;
+                pattern++;
+                text++;
+        }
+    }
+    return *text == '\0';
+}
+
+gitignore::gitignore(const std::string &git_dir,
+                     const std::string &excludes_file) {
+    ignore_list global;
+    if (!excludes_file.empty() && read_ignore_file(excludes_file, global)) {
+        lists.push_back(std::move(global));
+    }
+    ignore_list exclude;
+    if (!git_dir.empty() &&
+        read_ignore_file(git_dir + "/info/exclude", exclude)) {
+        lists.push_back(std::move(exclude));
+    }
+}
+
+void gitignore::push_directory(const std::string &root,
+                               const std::string &dir) {
+    ignore_list list;
+    list.base = dir;
+    std::string file = root;
+    if (!dir.empty()) file += "/" + dir;
+    file += "/.gitignore";
+
+    bool added = read_ignore_file(file, list) && !list.patterns.empty();
+    if (added) lists.push_back(std::move(list));
+    pushed.push_back({dir, added});
+}
+
+void gitignore::pop_directory() {
+    if (pushed.empty()) return;
+    if (pushed.back().added) lists.pop_back();
+    pushed.pop_back();
+}
+
+void gitignore::move_to(const std::string &root, const std::string &dir) {
+    auto holds = [&dir](const std::string &parent) {
+        return parent.empty() || dir == parent ||
+               (dir.size() > parent.size() && dir[parent.size()] == '/' &&
+                dir.compare(0, parent.size(), parent) == 0);
+    };
+    while (!pushed.empty() && !holds(pushed.back().dir)) pop_directory();
+
+    if (pushed.empty()) push_directory(root, "");
+    size_t end = pushed.back().dir.size();
+    while (end < dir.size()) {
+        size_t start = end == 0 ? 0 : end + 1;
+        end = dir.find('/', start);
+        if (end == std::string::npos) end = dir.size();
+        push_directory(root, dir.substr(0, end));
+    }
+}
+
+bool gitignore::ignored(const std::string &path, bool is_dir) const {
+    size_t slash = path.rfind('/');
+    size_t base_start = slash == std::string::npos ? 0 : slash + 1;
+    const char *basename = path.c_str() + base_start;
+    size_t basename_length = path.size() - base_start;
+    const std::string name(basename, basename_length);
+
+    for (auto list = lists.rbegin(); list != lists.rend(); list++) {
+        const char *relative = path.c_str();
+        size_t relative_length = path.size();
+        if (!list->base.empty()) {
+            if (path.size() <= list->base.size() ||
+                path[list->base.size()] != '/' ||
+                path.compare(0, list->base.size(), list->base) != 0) {
+                continue;
+            }
+            relative += list->base.size() + 1;
+            relative_length -= list->base.size() + 1;
+        }
+
+        // The last pattern that matches decides. A literal one found by name
+        // only has to be checked against the other patterns after it.
+        int best = -1;
+        if (!list->literals.empty()) {
+            auto it = list->literals.find(name);
+            if (it != list->literals.end()) {
+                best = is_dir ? it->second.any : it->second.file;
+            }
+        }
+        for (auto other = list->others.rbegin();
+             other != list->others.rend() && *other > best; other++) {
+            const ignore_pattern &pattern = list->patterns[*other];
+            if (pattern.directory_only && !is_dir) continue;
+            bool matched =
+                pattern.anchored
+                    ? match_pattern(pattern, relative, relative_length)
+                    : match_pattern(pattern, basename, basename_length);
+            if (matched) return !pattern.negated;
+        }
+        if (best >= 0) return !list->patterns[best].negated;
+    }
+    return false;
+}
@@ -0,0 +1,84 @@
+#ifndef GITIGNORE_H
+#define GITIGNORE_H
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class git_repository;
+
+// How a pattern is matched, most of them need no glob matching at all.
+enum class match_kind {
+    literal,  // "Makefile"
+    prefix,   // "npm-debug.log*"
+    suffix,   // "*.log"
+    glob
+};
+
+struct ignore_pattern {
+    std::string glob;
+    bool negated = false;
+    bool directory_only = false;
+    // Matched against the path relative to the file's directory instead of
+    // against the basename.
+    bool anchored = false;
+    match_kind kind = match_kind::glob;
+    // The glob without its '*' for prefix and suffix patterns.
+    std::string text;
+};
+
+// The patterns of one ignore file. base is the directory of the file relative
+// to the repository root, empty for the root and for the exclude files.
+struct ignore_list {
+    std::string base;
+    std::vector<ignore_pattern> patterns;
+
+    // Filled by read_ignore_file. The last literal basename pattern per name,
+    // once for any path and once for files, which directory only patterns do
+    // not match. Every other pattern is in others, in file order.
+    struct last_literal {
+        int any = -1;
+        int file = -1;
+    };
+    std::unordered_map<std::string, last_literal> literals;
+    std::vector<int> others;
+};
+
+// Decides which paths of a work tree git ignores. Lists are stacked in
+// increasing precedence: the global excludes file, .git/info/exclude and then
+// one .gitignore per directory on the way down, which a walk pushes when it
+// enters a directory and pops when it leaves it.
+class gitignore {
+   public:
+    // Sets up the excludes file and info/exclude of a repository. Either can
+    // be empty outside of one.
+    gitignore(const std::string &git_dir, const std::string &excludes_file);
+
+    // Reads the .gitignore of dir, given relative to root.
+    void push_directory(const std::string &root, const std::string &dir);
+    void pop_directory();
+    // Pops the directories that do not hold dir and pushes the ones missing
+    // on the way down to it, for walks that are not depth first.
+    void move_to(const std::string &root, const std::string &dir);
+
+    // path is relative to the repository root.
+    bool ignored(const std::string &path, bool is_dir) const;
+
+   private:
+    struct pushed_directory {
+        std::string dir;
+        // Whether it added a list.
+        bool added;
+    };
+
+    std::vector<ignore_list> lists;
+    std::vector<pushed_directory> pushed;
+};
+
+bool read_ignore_file(const std::string &file, ignore_list &list);
+// The global excludes file of a repository, core.excludesFile or git's
+// default.
+std::string excludes_file(const git_repository &repo);
+// Glob matching as git does it: '*' and '?' stop at '/', "**" crosses
+// directories.
+bool wildmatch(const char *pattern, const char *text);
+#endif
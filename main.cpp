@@ -1,64 +1,132 @@
+#include <algorithm>
+#include <iomanip>
+
 #include "components.h"
+#include "discovery.h"
+#include "event_loop.h"
+#include "project_model.h"
+#include "watcher.h"
 
 namespace fs = std::filesystem;
 
-void locate_projects(sqlite3 *db, std::vector<project> *projects) {
-    std::string project_dir = std::getenv("PROJECTS_DIR");
+std::string get_env(const char *name) {
+    const char *value = std::getenv(name);
+    return value == nullptr ? "" : value;
+}
+
+std::string get_projects_dir(Database &db) {
+    std::string project_dir = get_env("PROJECTS_DIR");
 
     if (project_dir.empty()) {
-        std::string home_dir = std::getenv("HOME");
+        std::string home_dir = get_env("HOME");
         if (home_dir.empty()) {
             exit_program(db, "HOME directory not found");
         }
         project_dir = home_dir;
     }
 
-    fs::path home_path(project_dir);
-    for (const auto &entry : fs::recursive_directory_iterator(home_path)) {
-        if (entry.is_directory() && entry.path().filename() == ".git") {
-            const auto path = entry.path().parent_path();
-            insert_projects(db, path.filename(), path);
-            project project = {-1, path.filename(), path};
-            project.id = get_project_id(db, project);
-            projects->push_back(project);
-        }
+    while (project_dir.size() > 1 && project_dir.back() == '/') {
+        project_dir.pop_back();
     }
+    return project_dir;
 }
 
-int main() {
-    sqlite3 *db;
-    int rc;
+// Runs on a background thread with its own connection, feeding the project
+// model while main_menu is already on screen.
+void locate_projects(const std::string &db_location,
+                     const std::string &project_dir,
+                     const discovery_options &options, project_model &model) {
+    Database db(db_location);
+    if (!db.is_open()) {
+        model.set_scanning(false);
+        return;
+    }
+
+    const std::string signature = discovery_signature(project_dir, options);
+    directory_index index;
+    load_directory_index(db, index, signature);
+
+    const std::unordered_map<std::string, int> known = get_project_ids(db);
+    std::unordered_set<std::string> found;
+    discover_projects(
+        project_dir, options,
+        [&](const std::string &path) {
+            auto it = known.find(path);
+            int id = it == known.end() ? -1 : it->second;
+            model.push({project_event_type::added, path, "", id});
+            model.count_found();
+            found.insert(path);
+        },
+        &index);
 
-    std::string db_location = std::getenv("PROJECTS_DB");
+    // A cancelled walk has not seen every directory, saving it would drop
+    // the rest from the index.
+    if (options.cancel == nullptr || !*options.cancel) {
+        save_directory_index(db, index, signature);
+        prune_projects(db, project_dir, known, found);
+    }
+    db.close();
+    model.set_scanning(false);
+}
+
+int main() {
+    std::string db_location = get_env("PROJECTS_DB");
     if (db_location.empty()) {
         db_location = "projects.db";
     }
 
-    rc = sqlite3_open(db_location.c_str(), &db);
+    Database db(db_location);
 
-    if (rc) {
-        std::cout << "Can't open database: " << sqlite3_errmsg(db) << std::endl;
+    if (!db.is_open()) {
+        std::cout << "Can't open database: " << db.error() << std::endl;
         return -1;
     }
 
     disable_cursor();
     setup_database(db);
+    db.start_writer();
 
-    std::vector<project> projects = {};
-    locate_projects(db, &projects);
+    const std::string project_dir = get_projects_dir(db);
+    std::atomic<bool> cancel_scan = false;
+    discovery_options options = discovery_options_from_env();
+    options.cancel = &cancel_scan;
+
+    // Before the threads that wake it.
+    start_event_loop();
+    project_model model;
+    model.set_scanning(true);
+    std::thread scanner(locate_projects, db_location, project_dir, options,
+                        std::ref(model));
+    project_watcher watcher(project_dir, options, model);
 
     set_raw_mode();
 
     int screen_width, screen_height;
-    get_console_size(screen_width, screen_height);
+    screen_size(screen_width, screen_height);
+
+    frame_buffer buffer(screen_width, screen_height);
 
-    std::vector<std::string> buffer(screen_height,
-                                    std::string(screen_width, ' '));
+    main_menu(db, buffer, model, screen_width, screen_height);
 
-    main_menu(db, buffer, projects, screen_width, screen_height);
+    cancel_scan = true;
+    scanner.join();
 
     enable_cursor();
     clear_screen();
+    flush_output();
     reset_raw_mode();
-    sqlite3_close(db);
+    db.close();
+
+    // PROJECTS_RENDER_STATS=1 reports what was sent to draw the screens.
+    if (!get_env("PROJECTS_RENDER_STATS").empty()) {
+        const render_stats &stats = get_render_stats();
+        double frames = std::max<size_t>(stats.frames, 1);
+        std::cerr << std::fixed << std::setprecision(2)
+                  << "frames: " << stats.frames << " (" << stats.full_frames
+                  << " full), cells: " << stats.cells
+                  << ", bytes: " << stats.bytes << " ("
+                  << stats.bytes / frames << " per frame), writes: "
+                  << stats.writes << " (" << stats.writes / frames
+                  << " per frame)" << std::endl;
+    }
 }
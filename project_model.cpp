@@ -0,0 +1,122 @@
+#include "project_model.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "event_loop.h"
+
+namespace fs = std::filesystem;
+
+static bool is_below(const std::string &path, const std::string &dir) {
+    return path.size() > dir.size() && path[dir.size()] == '/' &&
+           path.compare(0, dir.size(), dir) == 0;
+}
+
+static bool path_less(const project &a, const project &b) {
+    return a.path < b.path;
+}
+
+void project_model::push(project_event event) {
+    std::lock_guard<std::mutex> guard(lock);
+    events.push_back(std::move(event));
+    wake_event_loop();
+}
+
+void project_model::set_scanning(bool value) {
+    is_scanning = value;
+    wake_event_loop();
+}
+
+void project_model::count_found() {
+    found_count++;
+    wake_event_loop();
+}
+
+bool project_model::apply(Database &db) {
+    std::vector<project_event> pending;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (events.empty()) return false;
+        pending.swap(events);
+    }
+
+    bool changed = false;
+    std::vector<project> added;
+    for (const auto &event : pending) {
+        switch (event.type) {
+            case project_event_type::added:
+                if (std::binary_search(list.begin(), list.end(),
+                                       project{-1, "", event.path},
+                                       path_less)) {
+                    break;
+                }
+                changed |= add(event, added);
+                break;
+            case project_event_type::removed:
+                flush(db, added);
+                changed |= remove(event.path);
+                break;
+            case project_event_type::renamed:
+                flush(db, added);
+                changed |= rename(db, event.path, event.new_path);
+                break;
+        }
+    }
+    flush(db, added);
+    return changed;
+}
+
+bool project_model::add(const project_event &event,
+                        std::vector<project> &added) {
+    for (const auto &project : added) {
+        if (project.path == event.path) return false;
+    }
+    added.push_back({event.id, fs::path(event.path).filename(), event.path});
+    return true;
+}
+
+// New projects are registered in one go. Removals and renames flush first,
+// since they may refer to a project added earlier in the same batch.
+void project_model::flush(Database &db, std::vector<project> &added) {
+    if (added.empty()) return;
+
+    std::vector<project> unregistered;
+    for (const auto &project : added) {
+        if (project.id < 0) unregistered.push_back(project);
+    }
+    register_projects(db, unregistered);
+
+    for (auto &project : added) {
+        if (project.id >= 0) list.push_back(std::move(project));
+    }
+    list.insert(list.end(), unregistered.begin(), unregistered.end());
+    std::sort(list.begin(), list.end(), path_less);
+    added.clear();
+}
+
+// Removes the project at path and, when a whole directory went away, every
+// project below it.
+bool project_model::remove(const std::string &path) {
+    auto end = std::remove_if(list.begin(), list.end(), [&](const project &p) {
+        return p.path == path || is_below(p.path, path);
+    });
+    if (end == list.end()) return false;
+    list.erase(end, list.end());
+    return true;
+}
+
+bool project_model::rename(Database &db, const std::string &from,
+                           const std::string &to) {
+    bool changed = false;
+    for (auto &project : list) {
+        if (project.path != from && !is_below(project.path, from)) continue;
+        std::string path = to + project.path.substr(from.size());
+        rename_project(db, project.path, path);
+        project.path = path;
+        project.name = fs::path(path).filename();
+        project.id = get_project_id(db, project);
+        changed = true;
+    }
+    if (changed) std::sort(list.begin(), list.end(), path_less);
+    return changed;
+}
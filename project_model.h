@@ -0,0 +1,50 @@
+#ifndef PROJECT_MODEL_H
+#define PROJECT_MODEL_H
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "database.h"
+
+enum class project_event_type { added, removed, renamed };
+
+struct project_event {
+    project_event_type type;
+    std::string path;
+    // Destination of a rename.
+    std::string new_path;
+    // Set when the producer already knows the project's row.
+    int id = -1;
+};
+
+// The project list main_menu renders from. Background threads push events,
+// the UI thread applies them between frames and is the only one touching the
+// list itself. The list is kept sorted by path.
+class project_model {
+   public:
+    void push(project_event event);
+    // Applies the queued events. Returns true when the list changed.
+    bool apply(Database &db);
+
+    std::vector<project> &projects() { return list; }
+
+    // Progress of the startup scan, shown while the list is still filling.
+    void set_scanning(bool value);
+    bool scanning() const { return is_scanning; }
+    void count_found();
+    size_t found() const { return found_count; }
+
+   private:
+    std::mutex lock;
+    std::vector<project_event> events;
+    std::vector<project> list;
+    std::atomic<bool> is_scanning = false;
+    std::atomic<size_t> found_count = 0;
+
+    bool add(const project_event &event, std::vector<project> &added);
+    void flush(Database &db, std::vector<project> &added);
+    bool remove(const std::string &path);
+    bool rename(Database &db, const std::string &from, const std::string &to);
+};
+#endif
@@ -0,0 +1,184 @@
+#include "status_cache.h"
+
+#include <algorithm>
+
+#include "event_loop.h"
+
+// Status kept per project. The project menu shows a few lines of it and the
+// main menu only its first, the rest would only bloat the database.
+static const size_t MAX_STORED_STATUS = 64 * 1024;
+
+status_cache::status_cache(const std::string &db_location,
+                           unsigned int threads)
+    : db(db_location) {
+    if (db.is_open()) {
+        for (auto &[path, stored] : get_git_statuses(db)) {
+            entry &item = entries[path];
+            item.state = entry_state::stored;
+            item.known = true;
+            item.summary = summarize_git_status(stored.status);
+            item.stored = std::move(stored);
+        }
+    }
+
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    // Statuses that fall back to git mostly wait on the subprocess, so even
+    // a single core gets a second worker.
+    threads = std::max(threads, 2u);
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back(&status_cache::work, this);
+    }
+}
+
+status_cache::~status_cache() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void status_cache::enqueue(const std::string &path, entry &item, bool urgent) {
+    item.state = urgent ? entry_state::urgent : entry_state::queued;
+    if (urgent) {
+        urgent_queue.push_back(path);
+    } else {
+        queue.push_back(path);
+    }
+    wake.notify_one();
+}
+
+void status_cache::request(const std::string &path, bool urgent) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto [it, inserted] = entries.try_emplace(path);
+    entry &item = it->second;
+    if (inserted || item.state == entry_state::stored) {
+        enqueue(path, item, urgent);
+    } else if (urgent && item.state == entry_state::queued) {
+        // Moved ahead, the copy left in the normal queue is skipped.
+        enqueue(path, item, true);
+    }
+}
+
+bool status_cache::get(const std::string &path, git_summary &summary) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(path);
+    if (it == entries.end() || !it->second.known) return false;
+    summary = it->second.summary;
+    return true;
+}
+
+bool status_cache::get_status(const std::string &path, std::string &status) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(path);
+    if (it == entries.end() || !it->second.known) return false;
+    status = it->second.stored.status;
+    return true;
+}
+
+void status_cache::mark(const std::string &path, entry &item, bool force) {
+    if (force) item.forced = true;
+    if (item.state == entry_state::running) {
+        item.stale = true;
+    } else if (item.state == entry_state::done) {
+        enqueue(path, item, false);
+    }
+}
+
+void status_cache::revalidate(const std::string &path) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(path);
+    if (it == entries.end()) return;
+    it->second.deep = true;
+    mark(path, it->second, false);
+}
+
+void status_cache::invalidate(const std::string &path) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(path);
+    if (it != entries.end()) mark(path, it->second, true);
+}
+
+void status_cache::refresh(const std::string &path) {
+    std::lock_guard<std::mutex> guard(lock);
+    entry &item = entries[path];
+    item.forced = true;
+    item.opened = true;
+    item.deep = true;
+    if (item.state == entry_state::running) {
+        item.stale = true;
+    } else if (item.state != entry_state::urgent) {
+        enqueue(path, item, true);
+    }
+}
+
+void status_cache::invalidate_all() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &[path, item] : entries) {
+        mark(path, item, true);
+    }
+}
+
+void status_cache::work() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] {
+            return stopping || !urgent_queue.empty() || !queue.empty();
+        });
+        if (stopping) return;
+
+        bool urgent = !urgent_queue.empty();
+        std::deque<std::string> &source = urgent ? urgent_queue : queue;
+        std::string path = std::move(source.front());
+        source.pop_front();
+
+        entry &item = entries[path];
+        entry_state wanted = urgent ? entry_state::urgent : entry_state::queued;
+        if (item.state != wanted) continue;
+        item.state = entry_state::running;
+        bool forced = item.forced;
+        item.forced = false;
+        // The workers already run side by side, only the project the user
+        // waits on is spread over more threads.
+        unsigned int threads = item.opened ? 0 : 1;
+        bool deep = urgent || item.deep;
+        item.opened = false;
+        item.deep = false;
+        std::string previous = item.known ? item.stored.fingerprint : "";
+
+        guard.unlock();
+        stored_status fresh;
+        fresh.fingerprint = git_status_fingerprint(path, deep, threads);
+        bool unchanged =
+            !forced && fingerprint_matches(previous, fresh.fingerprint);
+        if (!unchanged) {
+            fresh.status = git_status(path, threads);
+            if (fresh.status.size() > MAX_STORED_STATUS) {
+                size_t end = fresh.status.rfind('\n', MAX_STORED_STATUS - 1);
+                fresh.status.resize(end == std::string::npos ? 0 : end + 1);
+            }
+            if (!fresh.fingerprint.empty() && db.is_open()) {
+                std::lock_guard<std::mutex> db_guard(db_lock);
+                save_git_status(db, path, fresh);
+            }
+        }
+        guard.lock();
+
+        // The map only grows, so the entry is still where it was.
+        if (!unchanged) {
+            item.summary = summarize_git_status(fresh.status);
+            item.stored = std::move(fresh);
+            item.known = true;
+            wake_event_loop();
+        }
+        if (item.stale) {
+            item.stale = false;
+            enqueue(path, item, false);
+        } else {
+            item.state = entry_state::done;
+        }
+    }
+}
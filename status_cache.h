@@ -0,0 +1,82 @@
+#ifndef STATUS_CACHE_H
+#define STATUS_CACHE_H
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "database.h"
+#include "git_status.h"
+
+// Git statuses of the projects, computed by a pool of background threads and
+// shared with the UI thread. Requests marked urgent, the rows on screen, are
+// served before the rest.
+//
+// Statuses are kept in the database with the fingerprint of the repository
+// they were taken from. A stored status is shown right away and only taken
+// again once the fingerprint changed. Only urgent requests and projects that
+// were opened are checked down to every tracked file, the rest only by HEAD,
+// the refs, the index and the top level.
+class status_cache {
+   public:
+    // threads of 0 picks the hardware concurrency.
+    explicit status_cache(const std::string &db_location,
+                          unsigned int threads = 0);
+    ~status_cache();
+
+    // Queues path unless its status is current or already on the way.
+    void request(const std::string &path, bool urgent);
+    // The last status of path. A status being checked or recomputed stays
+    // available until the new one is done.
+    bool get(const std::string &path, git_summary &summary);
+    // The whole `git status -bs` output.
+    bool get_status(const std::string &path, std::string &status);
+    // Checks the deep fingerprint of path again, the status is only
+    // recomputed if it changed.
+    void revalidate(const std::string &path);
+    // Recomputes the status whatever the fingerprint says, for changes it
+    // cannot see.
+    void invalidate(const std::string &path);
+    // Like invalidate, ahead of the other requests, for a project that was
+    // just opened. The last status is shown until the new one is done.
+    void refresh(const std::string &path);
+    void invalidate_all();
+
+   private:
+    // stored entries come from the database and were not checked yet.
+    enum class entry_state { stored, queued, urgent, running, done };
+    struct entry {
+        entry_state state = entry_state::queued;
+        bool known = false;
+        // Set when the entry is invalidated while it is being computed.
+        bool stale = false;
+        // Skips the fingerprint check the next time it is computed.
+        bool forced = false;
+        // Opened by the user, computed on every core rather than on one.
+        bool opened = false;
+        // Checked with the deep fingerprint, which stats every tracked file.
+        bool deep = false;
+        stored_status stored;
+        git_summary summary;
+    };
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::unordered_map<std::string, entry> entries;
+    std::deque<std::string> urgent_queue;
+    std::deque<std::string> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    // Only used by the workers, one at a time.
+    std::mutex db_lock;
+    Database db;
+
+    void work();
+    void enqueue(const std::string &path, entry &item, bool urgent);
+    void mark(const std::string &path, entry &item, bool force);
+};
+#endif
@@ -0,0 +1,326 @@
+#include "subprocess.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+extern char **environ;
+
+// How often an exited child is looked for while something it started still
+// holds its pipes open.
+static const int REAP_INTERVAL_MS = 50;
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static std::vector<std::string> child_environment(
+    const std::vector<std::string> &overrides) {
+    std::vector<std::string> env;
+    for (char **var = environ; *var != nullptr; var++) {
+        const char *equals = strchr(*var, '=');
+        size_t name_size = equals ? equals - *var : strlen(*var);
+        bool replaced = false;
+        for (const auto &entry : overrides) {
+            if (entry.size() > name_size && entry[name_size] == '=' &&
+                entry.compare(0, name_size, *var, name_size) == 0) {
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) env.push_back(*var);
+    }
+    env.insert(env.end(), overrides.begin(), overrides.end());
+    return env;
+}
+
+static void close_fd(int &fd) {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+subprocess::subprocess(subprocess &&other) noexcept {
+    *this = std::move(other);
+}
+
+subprocess &subprocess::operator=(subprocess &&other) noexcept {
+    if (this == &other) return *this;
+    reset();
+    pid = std::exchange(other.pid, -1);
+    group = other.group;
+    in_fd = std::exchange(other.in_fd, -1);
+    out_fd = std::exchange(other.out_fd, -1);
+    err_fd = std::exchange(other.err_fd, -1);
+    input = std::move(other.input);
+    written = other.written;
+    max_output = other.max_output;
+    deadline = other.deadline;
+    finished_flag = other.finished_flag;
+    timed_out_flag = other.timed_out_flag;
+    code = other.code;
+    signal_number = other.signal_number;
+    out_text = std::move(other.out_text);
+    err_text = std::move(other.err_text);
+    error_text = std::move(other.error_text);
+    return *this;
+}
+
+subprocess::~subprocess() { reset(); }
+
+void subprocess::reset() {
+    if (pid > 0 && !finished_flag) {
+        kill();
+        reap(0);
+    }
+    pid = -1;
+    close_pipes();
+}
+
+bool subprocess::start(const process_options &options) {
+    if (options.argv.empty()) {
+        error_text = "no command";
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    int in_pipe[2] = {-1, -1};
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    // Close on exec keeps the pipes of one child from leaking into another
+    // started at the same time from a different thread.
+    bool pipes_ok = true;
+    if (options.capture) {
+        if (!options.input.empty()) {
+            pipes_ok = pipe2(in_pipe, O_CLOEXEC) == 0;
+            if (pipes_ok) {
+                posix_spawn_file_actions_adddup2(&actions, in_pipe[0],
+                                                 STDIN_FILENO);
+            }
+        } else {
+            posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                             "/dev/null", O_RDONLY, 0);
+        }
+        pipes_ok = pipes_ok && pipe2(out_pipe, O_CLOEXEC) == 0;
+        if (pipes_ok) {
+            posix_spawn_file_actions_adddup2(&actions, out_pipe[1],
+                                             STDOUT_FILENO);
+        }
+        if (options.merge_output) {
+            if (pipes_ok) {
+                posix_spawn_file_actions_adddup2(&actions, out_pipe[1],
+                                                 STDERR_FILENO);
+            }
+        } else {
+            pipes_ok = pipes_ok && pipe2(err_pipe, O_CLOEXEC) == 0;
+            if (pipes_ok) {
+                posix_spawn_file_actions_adddup2(&actions, err_pipe[1],
+                                                 STDERR_FILENO);
+            }
+        }
+    }
+    if (!options.directory.empty()) {
+        posix_spawn_file_actions_addchdir_np(&actions,
+                                             options.directory.c_str());
+    }
+
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (options.own_group) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attributes, 0);
+    }
+    posix_spawnattr_setflags(&attributes, flags);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+
+    std::vector<std::string> env = child_environment(options.env);
+    std::vector<char *> envp;
+    for (auto &var : env) envp.push_back(var.data());
+    envp.push_back(nullptr);
+    std::vector<std::string> args = options.argv;
+    std::vector<char *> argv;
+    for (auto &arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    int error = pipes_ok ? posix_spawnp(&pid, argv[0], &actions, &attributes,
+                                        argv.data(), envp.data())
+                         : errno;
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    close_fd(in_pipe[0]);
+    close_fd(out_pipe[1]);
+    close_fd(err_pipe[1]);
+    in_fd = in_pipe[1];
+    out_fd = out_pipe[0];
+    err_fd = err_pipe[0];
+    if (error != 0) {
+        pid = -1;
+        close_pipes();
+        error_text = strerror(error);
+        return false;
+    }
+
+    for (int fd : {in_fd, out_fd, err_fd}) {
+        if (fd >= 0) fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+    group = options.own_group;
+    input = options.input;
+    written = 0;
+    max_output = options.max_output;
+    deadline = options.timeout_ms > 0 ? now_ms() + options.timeout_ms : 0;
+    write_input();
+    return true;
+}
+
+void subprocess::add_poll_fds(std::vector<pollfd> &fds) const {
+    if (in_fd >= 0) fds.push_back({in_fd, POLLOUT, 0});
+    if (out_fd >= 0) fds.push_back({out_fd, POLLIN, 0});
+    if (err_fd >= 0) fds.push_back({err_fd, POLLIN, 0});
+}
+
+int subprocess::timeout_left() const {
+    if (deadline == 0 || finished_flag) return -1;
+    return static_cast<int>(std::max<int64_t>(deadline - now_ms(), 0));
+}
+
+void subprocess::write_input() {
+    if (in_fd < 0) return;
+    // A child that exits without reading its input must not take us down
+    // with SIGPIPE. The signal is blocked for this thread only and a pending
+    // one is taken back before unblocking it.
+    sigset_t pipe_signal, old_mask;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, &old_mask);
+    bool broken = false;
+    while (written < input.size()) {
+        ssize_t count =
+            write(in_fd, input.data() + written, input.size() - written);
+        if (count > 0) {
+            written += count;
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else {
+            broken = count < 0 && errno != EAGAIN;
+            break;
+        }
+    }
+    if (broken) {
+        timespec zero = {0, 0};
+        sigset_t pending;
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE) &&
+            !sigismember(&old_mask, SIGPIPE)) {
+            sigtimedwait(&pipe_signal, nullptr, &zero);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    if (broken || written == input.size()) close_fd(in_fd);
+}
+
+void subprocess::read_pipe(int &fd, std::string &text) {
+    if (fd < 0) return;
+    char buffer[4096];
+    while (true) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count > 0) {
+            if (text.size() < max_output) {
+                text.append(buffer,
+                            std::min<size_t>(count, max_output - text.size()));
+            }
+            continue;
+        }
+        if (count < 0 && errno == EINTR) continue;
+        if (count == 0 || errno != EAGAIN) close_fd(fd);
+        return;
+    }
+}
+
+void subprocess::close_pipes() {
+    close_fd(in_fd);
+    close_fd(out_fd);
+    close_fd(err_fd);
+}
+
+void subprocess::kill() {
+    if (pid <= 0 || finished_flag) return;
+    ::kill(group ? -pid : pid, SIGKILL);
+}
+
+bool subprocess::update() {
+    if (pid <= 0 || finished_flag) return finished_flag;
+    write_input();
+    read_pipe(out_fd, out_text);
+    read_pipe(err_fd, err_text);
+
+    if (deadline != 0 && now_ms() >= deadline) {
+        timed_out_flag = true;
+        deadline = 0;
+        kill();
+    }
+
+    if (!reap(WNOHANG)) return false;
+    // Whatever the child wrote is in the pipes by now. Something it started
+    // could keep them open, so they are not read up to end of file.
+    read_pipe(out_fd, out_text);
+    read_pipe(err_fd, err_text);
+    close_pipes();
+    return true;
+}
+
+bool subprocess::reap(int flags) {
+    int status;
+    pid_t reaped;
+    do {
+        reaped = waitpid(pid, &status, flags);
+    } while (reaped < 0 && errno == EINTR);
+    if (reaped == 0) return false;
+    finished_flag = true;
+    if (reaped < 0) return true;
+    if (WIFEXITED(status)) {
+        code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        signal_number = WTERMSIG(status);
+    }
+    return true;
+}
+
+int subprocess::wait() {
+    while (!update()) {
+        if (pid <= 0) return code;
+        std::vector<pollfd> fds;
+        add_poll_fds(fds);
+        int timeout = timeout_left();
+        if (fds.empty() && timeout < 0) {
+            reap(0);
+            continue;
+        }
+        if (timeout < 0 || timeout > REAP_INTERVAL_MS) {
+            timeout = REAP_INTERVAL_MS;
+        }
+        poll(fds.data(), fds.size(), timeout);
+    }
+    return code;
+}
+
+subprocess run_process(const process_options &options) {
+    subprocess process;
+    if (process.start(options)) process.wait();
+    return process;
+}
@@ -0,0 +1,100 @@
+#ifndef SUBPROCESS_H
+#define SUBPROCESS_H
+#include <poll.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct process_options {
+    // The program and its arguments, the program is looked up in PATH.
+    std::vector<std::string> argv;
+    // Working directory of the child, empty keeps ours.
+    std::string directory;
+    // NAME=value entries set on top of our environment.
+    std::vector<std::string> env;
+    // Pipes stdout and stderr back and feeds input to stdin. Otherwise the
+    // child shares our terminal.
+    bool capture = true;
+    std::string input;
+    // Sends stderr to the stdout pipe, keeping the two in order.
+    bool merge_output = false;
+    // Output kept per stream, the rest is read and dropped.
+    size_t max_output = 1024 * 1024;
+    // Puts the child in a process group of its own, so a kill also takes
+    // down whatever it started.
+    bool own_group = false;
+    // The child is killed once it runs longer than this, 0 waits forever.
+    int timeout_ms = 0;
+};
+
+// A child process started with posix_spawn. Nothing here touches process
+// wide state such as the working directory, so children can be started and
+// driven from any thread.
+class subprocess {
+   public:
+    subprocess() = default;
+    subprocess(const subprocess &) = delete;
+    subprocess &operator=(const subprocess &) = delete;
+    subprocess(subprocess &&other) noexcept;
+    subprocess &operator=(subprocess &&other) noexcept;
+    // Kills and reaps a child that is still running.
+    ~subprocess();
+
+    // Returns false, with the reason in error(), if the child could not be
+    // started.
+    bool start(const process_options &options);
+
+    // Adds the pipes still open to fds, for callers that wait on several
+    // children at once.
+    void add_poll_fds(std::vector<pollfd> &fds) const;
+    // Milliseconds until the timeout, -1 when there is none.
+    int timeout_left() const;
+    // Moves whatever the pipes are ready for, enforces the timeout and reaps
+    // the child if it exited. Never blocks, returns finished().
+    bool update();
+    // Blocks until the child exited and returns exit_code().
+    int wait();
+    void kill();
+
+    bool started() const { return pid > 0 || finished_flag; }
+    bool finished() const { return finished_flag; }
+    bool timed_out() const { return timed_out_flag; }
+    // The exit code, or -1 if the child was killed by a signal.
+    int exit_code() const { return code; }
+    int term_signal() const { return signal_number; }
+    const std::string &out() const { return out_text; }
+    const std::string &err() const { return err_text; }
+    const std::string &error() const { return error_text; }
+
+   private:
+    pid_t pid = -1;
+    bool group = false;
+    int in_fd = -1;
+    int out_fd = -1;
+    int err_fd = -1;
+    std::string input;
+    size_t written = 0;
+    size_t max_output = 0;
+    int64_t deadline = 0;  // milliseconds on the steady clock, 0 for none
+
+    bool finished_flag = false;
+    bool timed_out_flag = false;
+    int code = -1;
+    int signal_number = 0;
+    std::string out_text;
+    std::string err_text;
+    std::string error_text;
+
+    void write_input();
+    void read_pipe(int &fd, std::string &text);
+    void close_pipes();
+    // Waits for the child with waitpid flags, true once it is gone.
+    bool reap(int flags);
+    void reset();
+};
+
+// Runs a command to completion.
+subprocess run_process(const process_options &options);
+#endif
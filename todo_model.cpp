@@ -0,0 +1,90 @@
+#include "todo_model.h"
+
+#include <algorithm>
+
+todo_model::todo_model(Database &db, int project_id)
+    : db(db), project_id(project_id) {
+    get_todo_range(db, project_id, stored, max_id);
+}
+
+void todo_model::load(size_t first, size_t count) {
+    size_t end = std::min(first + count, stored);
+    if (first >= end) return;
+
+    if (rows.empty() || end < window_start || first > window_end()) {
+        // Nothing to extend, start a new window at first.
+        rows.clear();
+        int id = get_todo_id_at(db, project_id, max_id, first);
+        if (id < 0) return;
+        rows = get_todos_after(db, project_id, id - 1, max_id, end - first);
+        window_start = first;
+        return;
+    }
+
+    if (first < window_start) {
+        std::vector<todo> before = get_todos_before(
+            db, project_id, rows.front().id, window_start - first);
+        window_start -= before.size();
+        rows.insert(rows.begin(), std::make_move_iterator(before.rbegin()),
+                    std::make_move_iterator(before.rend()));
+    }
+    if (end > window_end()) {
+        std::vector<todo> after = get_todos_after(
+            db, project_id, rows.back().id, max_id, end - window_end());
+        rows.insert(rows.end(), std::make_move_iterator(after.begin()),
+                    std::make_move_iterator(after.end()));
+    }
+
+    // Drop the rows that scrolled far out of view.
+    size_t keep = std::max<size_t>(count, 1) * KEEP_FACTOR;
+    if (rows.size() > keep) {
+        size_t drop_front = 0;
+        if (first > window_start + keep / 2) {
+            drop_front = first - window_start - keep / 2;
+        }
+        rows.erase(rows.begin(), rows.begin() + drop_front);
+        window_start += drop_front;
+        if (rows.size() > keep) rows.resize(keep);
+    }
+}
+
+const todo &todo_model::at(size_t index) {
+    if (index >= stored) return added[index - stored];
+    if (index < window_start || index >= window_end()) load(index, 1);
+    return rows[index - window_start];
+}
+
+int todo_model::index_of(int id) {
+    for (size_t i = 0; i < added.size(); i++) {
+        if (added[i].id == id) return stored + i;
+    }
+    if (id > max_id) return -1;
+
+    size_t index = count_todos_before(db, project_id, id);
+    load(index, 1);
+    if (index >= window_start && index < window_end() &&
+        rows[index - window_start].id == id) {
+        return index;
+    }
+    return -1;
+}
+
+void todo_model::add(const std::string &task) {
+    int id = add_todo(db, {project_id, "", ""}, task);
+    added.push_back({id, project_id, task});
+}
+
+void todo_model::remove(size_t index) {
+    if (index >= stored) {
+        auto it = added.begin() + (index - stored);
+        remove_todo(db, *it);
+        added.erase(it);
+        return;
+    }
+
+    load(index, 1);
+    auto it = rows.begin() + (index - window_start);
+    remove_todo(db, *it);
+    rows.erase(it);
+    stored--;
+}
@@ -0,0 +1,44 @@
+#ifndef TODO_MODEL_H
+#define TODO_MODEL_H
+#include <string>
+#include <vector>
+
+#include "database.h"
+
+// The todos of one project, of which only the rows around the visible window
+// are held in memory. Rows are read by seeking on id, and adds and removes
+// are applied in place instead of reading the list again.
+//
+// Todos added through the model are kept in a tail behind the rows that were
+// stored when it was created, so they can be shown before the background
+// writer has committed them.
+class todo_model {
+   public:
+    todo_model(Database &db, int project_id);
+
+    size_t size() const { return stored + added.size(); }
+    // Makes the rows [first, first + count) available to at().
+    void load(size_t first, size_t count);
+    const todo &at(size_t index);
+    // Position of a todo, or -1 when the project has no such todo.
+    int index_of(int id);
+
+    void add(const std::string &task);
+    void remove(size_t index);
+
+   private:
+    // Upper bound on the rows held, relative to the last requested window.
+    static const size_t KEEP_FACTOR = 3;
+
+    Database &db;
+    const int project_id;
+    size_t stored = 0;
+    int max_id = 0;
+    std::vector<todo> added;
+
+    size_t window_start = 0;
+    std::vector<todo> rows;
+
+    size_t window_end() const { return window_start + rows.size(); }
+};
+#endif
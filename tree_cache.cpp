@@ -0,0 +1,49 @@
+#include "tree_cache.h"
+
+#include <cstdlib>
+
+// Each cached tree holds an inotify instance, of which a user only gets 128
+// by default.
+static const size_t MAX_TREES = 16;
+
+size_t tree_cache_budget_from_env() {
+    size_t megabytes = 64;
+    const char *env = std::getenv("PROJECTS_TREE_CACHE_MB");
+    if (env != nullptr) megabytes = std::strtoul(env, nullptr, 10);
+    return megabytes * 1024 * 1024;
+}
+
+tree_cache::tree_cache(size_t budget) : budget(budget) {}
+
+std::shared_ptr<file_tree> tree_cache::open(int project_id,
+                                            const std::string &path) {
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->project_id != project_id) continue;
+        if (it->path != path) {
+            // Moved since, the tree is read again from its new place.
+            entries.erase(it);
+            break;
+        }
+        entries.splice(entries.begin(), entries, it);
+        return it->tree;
+    }
+    entries.push_front({project_id, path, std::make_shared<file_tree>(path)});
+    trim();
+    return entries.front().tree;
+}
+
+void tree_cache::trim() {
+    size_t total = 0;
+    for (const auto &item : entries) {
+        total += item.tree->memory();
+    }
+    size_t count = entries.size();
+    for (auto it = entries.end(); it != entries.begin();) {
+        --it;
+        if (total <= budget && count <= MAX_TREES) break;
+        if (it->tree.use_count() > 1) continue;
+        total -= it->tree->memory();
+        count--;
+        it = entries.erase(it);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TREE_CACHE_H
+#define TREE_CACHE_H
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "file_tree.h"
+
+// The file trees of the projects opened last, so going back to one shows it
+// as it was left. They keep their inotify watches while cached and catch up
+// with what changed when shown again. The least recently opened are dropped
+// once the trees no longer fit in the memory budget.
+class tree_cache {
+   public:
+    explicit tree_cache(size_t budget);
+
+    // The tree of a project, from the cache or read anew.
+    std::shared_ptr<file_tree> open(int project_id, const std::string &path);
+    // Drops trees that are not open until the rest fit the budget.
+    void trim();
+
+   private:
+    struct entry {
+        int project_id;
+        std::string path;
+        std::shared_ptr<file_tree> tree;
+    };
+
+    const size_t budget;
+    // Most recently opened first.
+    std::list<entry> entries;
+};
+
+// PROJECTS_TREE_CACHE_MB, 64 MB by default.
+size_t tree_cache_budget_from_env();
+#endif
@@ -0,0 +1,358 @@
+#include "tree_walker.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string_view>
+#include <thread>
+
+#include "git_repository.h"
+#include "gitignore.h"
+
+bool dir_reader::next(const char *&name, unsigned char &type) {
+    while (true) {
+        if (offset >= size) {
+            if (size < 0) return false;
+            size = getdents64(fd, buffer, sizeof(buffer));
+            offset = 0;
+            if (size <= 0) {
+                size = -1;
+                return false;
+            }
+        }
+        const dirent64 *entry =
+            reinterpret_cast<const dirent64 *>(buffer + offset);
+        offset += entry->d_reclen;
+        name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        type = entry->d_type;
+        return true;
+    }
+}
+
+node_type entry_type(int dir_fd, const char *name, unsigned char type,
+                     bool follow) {
+    switch (type) {
+        case DT_DIR:
+            return node_type::directory;
+        case DT_REG:
+            return node_type::file;
+        case DT_LNK:
+            if (!follow) return node_type::symlink;
+            break;
+        case DT_UNKNOWN:
+            break;
+        default:
+            return node_type::other;
+    }
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+        return type == DT_LNK ? node_type::symlink : node_type::other;
+    }
+    if (S_ISDIR(st.st_mode)) return node_type::directory;
+    if (S_ISREG(st.st_mode)) return node_type::file;
+    if (S_ISLNK(st.st_mode)) return node_type::symlink;
+    return node_type::other;
+}
+
+void dir_batch::add(const char *name, node_type type) {
+    offsets.push_back(names.size());
+    names.append(name);
+    names.push_back('\0');
+    types.push_back(type);
+}
+
+void dir_batch::clear() {
+    names.clear();
+    offsets.clear();
+    types.clear();
+}
+
+void dir_batch::sort() {
+    std::vector<size_t> order(size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        bool a_dir = types[a] == node_type::directory;
+        bool b_dir = types[b] == node_type::directory;
+        if (a_dir != b_dir) return a_dir;
+        return strcmp(name(a), name(b)) < 0;
+    });
+
+    std::vector<uint32_t> sorted_offsets;
+    std::vector<node_type> sorted_types;
+    for (size_t i : order) {
+        sorted_offsets.push_back(offsets[i]);
+        sorted_types.push_back(types[i]);
+    }
+    offsets.swap(sorted_offsets);
+    types.swap(sorted_types);
+}
+
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+static size_t name_hash(const char *name) {
+    return std::hash<std::string_view>()(name);
+}
+
+node_table::node_table() : slots(64, EMPTY_SLOT) {
+    parents.push_back(0);
+    names.push_back(intern(""));
+    types.push_back(node_type::directory);
+    firsts.push_back(0);
+    counts.push_back(0);
+}
+
+void node_table::grow_slots() {
+    std::vector<uint32_t> old(slots.size() * 2, EMPTY_SLOT);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (uint32_t offset : old) {
+        if (offset == EMPTY_SLOT) continue;
+        size_t i = name_hash(arena.data() + offset) & mask;
+        while (slots[i] != EMPTY_SLOT) i = (i + 1) & mask;
+        slots[i] = offset;
+    }
+}
+
+uint32_t node_table::intern(const char *name) {
+    if ((interned + 1) * 2 > slots.size()) grow_slots();
+    size_t mask = slots.size() - 1;
+    for (size_t i = name_hash(name) & mask;; i = (i + 1) & mask) {
+        if (slots[i] == EMPTY_SLOT) {
+            slots[i] = arena.size();
+            arena.append(name);
+            arena.push_back('\0');
+            interned++;
+            return slots[i];
+        }
+        if (strcmp(arena.data() + slots[i], name) == 0) return slots[i];
+    }
+}
+
+std::string node_table::path(uint32_t node) const {
+    std::vector<uint32_t> chain;
+    for (uint32_t i = node; i != 0; i = parents[i]) chain.push_back(i);
+    std::string path;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        if (!path.empty()) path += '/';
+        path += name(*it);
+    }
+    return path;
+}
+
+size_t node_table::memory() const {
+    return parents.capacity() * sizeof(uint32_t) +
+           names.capacity() * sizeof(uint32_t) +
+           types.capacity() * sizeof(node_type) +
+           firsts.capacity() * sizeof(uint32_t) +
+           counts.capacity() * sizeof(uint32_t) + arena.capacity() +
+           slots.capacity() * sizeof(uint32_t);
+}
+
+uint32_t node_table::add_children(uint32_t parent, const dir_batch &batch) {
+    uint32_t first = size();
+    for (size_t i = 0; i < batch.size(); i++) {
+        parents.push_back(parent);
+        names.push_back(intern(batch.name(i)));
+        types.push_back(batch.types[i]);
+        firsts.push_back(0);
+        counts.push_back(0);
+    }
+    firsts[parent] = first;
+    counts[parent] = batch.size();
+    return first;
+}
+
+void node_table::move_children(uint32_t from, uint32_t to) {
+    firsts[to] = firsts[from];
+    counts[to] = counts[from];
+    for (uint32_t i = 0; i < counts[to]; i++) {
+        parents[firsts[to] + i] = to;
+    }
+    firsts[from] = 0;
+    counts[from] = 0;
+}
+
+bool node_table::same_children(uint32_t parent, const dir_batch &batch) const {
+    if (counts[parent] != batch.size()) return false;
+    for (uint32_t i = 0; i < counts[parent]; i++) {
+        uint32_t child = firsts[parent] + i;
+        if (types[child] != batch.types[i] ||
+            strcmp(name(child), batch.name(i)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<uint32_t> node_table::compact() {
+    std::vector<uint32_t> remap(size(), NONE);
+    remap[0] = 0;
+    node_table fresh;
+    // The old node of each new one, in the order they are added.
+    std::vector<uint32_t> order = {0};
+    for (uint32_t node = 0; node < order.size(); node++) {
+        uint32_t old = order[node];
+        fresh.firsts[node] = fresh.size();
+        fresh.counts[node] = counts[old];
+        for (uint32_t i = 0; i < counts[old]; i++) {
+            uint32_t child = firsts[old] + i;
+            remap[child] = fresh.size();
+            order.push_back(child);
+            fresh.parents.push_back(node);
+            fresh.names.push_back(fresh.intern(name(child)));
+            fresh.types.push_back(types[child]);
+            fresh.firsts.push_back(0);
+            fresh.counts.push_back(0);
+        }
+    }
+
+    parents.swap(fresh.parents);
+    names.swap(fresh.names);
+    types.swap(fresh.types);
+    firsts.swap(fresh.firsts);
+    counts.swap(fresh.counts);
+    arena.swap(fresh.arena);
+    slots.swap(fresh.slots);
+    std::swap(interned, fresh.interned);
+    return remap;
+}
+
+namespace {
+
+// Workers share one queue of directories. Each reads a directory into a
+// batch of its own and only takes the lock to add it to the table and queue
+// the directories in it.
+class walk_pool {
+   public:
+    walk_pool(int root_fd, const walk_options &options, node_table &table)
+        : root_fd(root_fd), options(options), table(table) {}
+
+    void run(const std::string &root) {
+        if (options.gitignore) {
+            git_repository repo(root);
+            git_dir = repo.path();
+            if (repo.is_open()) excludes = excludes_file(repo);
+        }
+        this->root = root;
+        queue.emplace_back(0, "");
+        pending = 1;
+
+        unsigned int count = options.threads;
+        if (count == 0) count = std::thread::hardware_concurrency();
+        if (count == 0) count = 1;
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < count; i++) {
+            workers.emplace_back(&walk_pool::work, this);
+        }
+        work();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+   private:
+    const int root_fd;
+    const walk_options &options;
+    node_table &table;
+    std::string root;
+    std::string git_dir;
+    std::string excludes;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::pair<uint32_t, std::string>> queue;
+    // Directories queued or being read, the walk is done at zero.
+    size_t pending = 0;
+
+    bool cancelled() const {
+        return options.cancel != nullptr && *options.cancel;
+    }
+
+    void work() {
+        std::unique_ptr<gitignore> ignore;
+        if (options.gitignore) {
+            ignore = std::make_unique<gitignore>(git_dir, excludes);
+        }
+        dir_batch batch;
+        std::vector<uint32_t> subdirs;
+
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wake.wait(guard,
+                      [this] { return pending == 0 || !queue.empty(); });
+            if (pending == 0) return;
+            auto [node, dir] = std::move(queue.front());
+            queue.pop_front();
+
+            guard.unlock();
+            read(dir, ignore.get(), batch, subdirs);
+            guard.lock();
+
+            uint32_t first = table.add_children(node, batch);
+            for (uint32_t i : subdirs) {
+                std::string child = dir;
+                if (!child.empty()) child += '/';
+                child += batch.name(i);
+                queue.emplace_back(first + i, std::move(child));
+            }
+            pending += subdirs.size();
+            if (--pending == 0 || !subdirs.empty()) wake.notify_all();
+        }
+    }
+
+    void read(const std::string &dir, gitignore *ignore, dir_batch &batch,
+              std::vector<uint32_t> &subdirs) {
+        batch.clear();
+        subdirs.clear();
+        if (cancelled()) return;
+        int fd = openat(root_fd, dir.empty() ? "." : dir.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) return;
+
+        if (ignore != nullptr) ignore->move_to(root, dir);
+        std::string path = dir;
+        if (!path.empty()) path += '/';
+        size_t base = path.size();
+
+        dir_reader reader(fd);
+        const char *name;
+        unsigned char d_type;
+        while (reader.next(name, d_type)) {
+            if (strcmp(name, ".git") == 0) continue;
+            node_type type = entry_type(fd, name, d_type, false);
+            bool is_dir = type == node_type::directory;
+            if (ignore != nullptr) {
+                path.resize(base);
+                path += name;
+                if (ignore->ignored(path, is_dir)) continue;
+            }
+            if (is_dir) subdirs.push_back(batch.size());
+            batch.add(name, type);
+        }
+        close(fd);
+    }
+};
+
+}  // namespace
+
+void walk_tree(const std::string &root, const walk_options &options,
+               node_table &table) {
+    int root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) return;
+    walk_pool pool(root_fd, options, table);
+    pool.run(root);
+    close(root_fd);
+}
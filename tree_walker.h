@@ -0,0 +1,114 @@
+#ifndef TREE_WALKER_H
+#define TREE_WALKER_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class node_type : uint8_t { file, directory, symlink, other };
+
+// Reads the entries of an open directory with getdents64 into a fixed
+// buffer, with no allocation per entry. Does not own fd.
+class dir_reader {
+   public:
+    explicit dir_reader(int fd) : fd(fd) {}
+
+    // The next entry other than "." and "..". name stays valid until the next
+    // call. type is the d_type the file system gave, DT_UNKNOWN on some.
+    bool next(const char *&name, unsigned char &type);
+
+   private:
+    int fd;
+    long size = 0;
+    long offset = 0;
+    alignas(8) char buffer[32 * 1024];
+};
+
+// Resolves DT_UNKNOWN, and links too when follow is set, with one fstatat.
+node_type entry_type(int dir_fd, const char *name, unsigned char type,
+                     bool follow);
+
+// The entries of one directory, collected before they go into a table.
+struct dir_batch {
+    std::string names;  // NUL terminated one after the other
+    std::vector<uint32_t> offsets;
+    std::vector<node_type> types;
+
+    void add(const char *name, node_type type);
+    void clear();
+    size_t size() const { return offsets.size(); }
+    const char *name(size_t i) const { return names.data() + offsets[i]; }
+    // Directories first, each group by name.
+    void sort();
+};
+
+// A directory tree as parallel arrays. Node 0 is the root and the children of
+// a directory are stored next to each other. Names are interned, every
+// distinct name is kept once in a single arena.
+class node_table {
+   public:
+    // A node compact removed.
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    node_table();
+    node_table(const node_table &) = delete;
+    node_table &operator=(const node_table &) = delete;
+
+    size_t size() const { return parents.size(); }
+    uint32_t parent(uint32_t node) const { return parents[node]; }
+    const char *name(uint32_t node) const { return arena.data() + names[node]; }
+    node_type type(uint32_t node) const { return types[node]; }
+    bool is_dir(uint32_t node) const {
+        return types[node] == node_type::directory;
+    }
+    // The children of a directory, none until it is read.
+    uint32_t first_child(uint32_t node) const { return firsts[node]; }
+    uint32_t child_count(uint32_t node) const { return counts[node]; }
+    // Relative to the root, empty for the root itself.
+    std::string path(uint32_t node) const;
+    // Bytes held by the arrays and the arena.
+    size_t memory() const;
+
+    // Adds the entries of batch as the children of parent and returns the
+    // first of them.
+    uint32_t add_children(uint32_t parent, const dir_batch &batch);
+    // Hands the children of from over to to, from is left without any.
+    void move_children(uint32_t from, uint32_t to);
+    // Whether the children of parent are the entries of batch, in order.
+    bool same_children(uint32_t parent, const dir_batch &batch) const;
+    // Rebuilds the table from what the root still reaches, leaving out the
+    // nodes no directory holds anymore and the names only they used. Returns
+    // the new number of each old node, NONE for those left out.
+    std::vector<uint32_t> compact();
+
+   private:
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> names;
+    std::vector<node_type> types;
+    std::vector<uint32_t> firsts;
+    std::vector<uint32_t> counts;
+    std::string arena;
+    // Open addressing over arena offsets, at most half full.
+    std::vector<uint32_t> slots;
+    size_t interned = 0;
+
+    uint32_t intern(const char *name);
+    void grow_slots();
+};
+
+struct walk_options {
+    // Leaves out what git ignores, when root is in a repository.
+    bool gitignore = true;
+    // Number of worker threads, 0 picks the hardware concurrency.
+    unsigned int threads = 0;
+    // Stops the walk early once set.
+    const std::atomic<bool> *cancel = nullptr;
+};
+
+// Walks everything below root in parallel into table, which must be empty.
+// Directories are opened relative to root with openat, entry types come
+// from d_type and links are not followed.
+void walk_tree(const std::string &root, const walk_options &options,
+               node_table &table);
+#endif
@@ -3,19 +3,182 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#include <filesystem>
+#include <algorithm>
+#include <cerrno>
+
+#include "event_loop.h"
 
 termios OLDT;
 bool HAS_OLDT = false;
-const std::string END_STYLE("\033[0m");
+
+// A style packed into one word. The foreground and the background take 9
+// bits each, 0 for the default or 1 plus a 256 color index, and SGR
+// attributes 1 to 9 a bit each above them.
+static const int COLOR_BITS = 9;
+static const uint32_t COLOR_MASK = (1u << COLOR_BITS) - 1;
+static const int BACKGROUND_SHIFT = COLOR_BITS;
+static const int ATTRIBUTE_SHIFT = 2 * COLOR_BITS;
+// At most this many parameters are read from one sequence.
+static const int MAX_PARAMETERS = 16;
+// Output is wrapped in synchronized updates, mode 2026, so the terminal shows
+// it all at once. Terminals without the mode ignore it.
+static const char BEGIN_UPDATE[] = "\033[?2026h";
+static const char END_UPDATE[] = "\033[?2026l";
+// Enough for a full frame of a large terminal.
+static const size_t OUTPUT_RESERVE = 64 * 1024;
+
+namespace {
+
+// What the terminal shows, as of the last draw_buffer.
+frame_buffer SHOWN;
+bool SHOWN_VALID = false;
+std::vector<uint32_t> STYLES = {0};
+// What waits for flush_output, kept between frames so its memory is too.
+std::string OUTPUT;
+render_stats STATS;
+
+}  // namespace
+
+static std::string &output() {
+    if (OUTPUT.empty()) {
+        if (OUTPUT.capacity() < OUTPUT_RESERVE) OUTPUT.reserve(OUTPUT_RESERVE);
+        OUTPUT += BEGIN_UPDATE;
+    }
+    return OUTPUT;
+}
+
+void frame_buffer::resize(int width, int height) {
+    columns = std::max(width, 0);
+    rows = std::max(height, 0);
+    cells.assign(static_cast<size_t>(columns) * rows, cell());
+}
+
+void frame_buffer::clear() { std::fill(cells.begin(), cells.end(), cell()); }
+
+static uint32_t set_color(uint32_t style, int shift, uint32_t color) {
+    return (style & ~(COLOR_MASK << shift)) | color << shift;
+}
+
+static uint32_t apply_parameters(const int *parameters, int count,
+                                 uint32_t style) {
+    for (int i = 0; i < count; i++) {
+        int code = parameters[i];
+        if (code == 0) {
+            style = 0;
+        } else if (code >= 1 && code <= 9) {
+            style |= 1u << (ATTRIBUTE_SHIFT + code - 1);
+        } else if (code == 22) {
+            style &= ~(3u << ATTRIBUTE_SHIFT);  // neither bold nor dim
+        } else if (code >= 23 && code <= 29) {
+            style &= ~(1u << (ATTRIBUTE_SHIFT + code - 21));
+        } else if (code >= 30 && code <= 37) {
+            style = set_color(style, 0, 1 + code - 30);
+        } else if (code >= 90 && code <= 97) {
+            style = set_color(style, 0, 1 + 8 + code - 90);
+        } else if (code == 39) {
+            style = set_color(style, 0, 0);
+        } else if (code >= 40 && code <= 47) {
+            style = set_color(style, BACKGROUND_SHIFT, 1 + code - 40);
+        } else if (code >= 100 && code <= 107) {
+            style = set_color(style, BACKGROUND_SHIFT, 1 + 8 + code - 100);
+        } else if (code == 49) {
+            style = set_color(style, BACKGROUND_SHIFT, 0);
+        } else if ((code == 38 || code == 48) && i + 1 < count) {
+            // 256 colors, true colors are skipped.
+            int shift = code == 38 ? 0 : BACKGROUND_SHIFT;
+            if (parameters[i + 1] == 5 && i + 2 < count) {
+                style = set_color(style, shift, 1 + (parameters[i + 2] & 255));
+                i += 2;
+            } else if (parameters[i + 1] == 2) {
+                i += 4;
+            }
+        }
+    }
+    return style;
+}
+
+static uint32_t apply_sgr(std::string_view colors, uint32_t style) {
+    size_t i = 0;
+    while ((i = colors.find("\033[", i)) != std::string_view::npos) {
+        size_t end = colors.find('m', i);
+        if (end == std::string_view::npos) break;
+        int parameters[MAX_PARAMETERS];
+        int count = 0;
+        int value = 0;
+        for (size_t k = i + 2; k <= end; k++) {
+            if (k == end || colors[k] == ';') {
+                if (count < MAX_PARAMETERS) parameters[count++] = value;
+                value = 0;
+            } else if (colors[k] >= '0' && colors[k] <= '9') {
+                value = value * 10 + colors[k] - '0';
+            }
+        }
+        style = apply_parameters(parameters, count, style);
+        i = end + 1;
+    }
+    return style;
+}
+
+uint16_t style_of(std::string_view colors, uint16_t base) {
+    uint32_t style = apply_sgr(colors, STYLES[base]);
+    // Few styles are ever used, a scan is faster than hashing.
+    for (size_t i = 0; i < STYLES.size(); i++) {
+        if (STYLES[i] == style) return i;
+    }
+    if (STYLES.size() > UINT16_MAX) return 0;
+    STYLES.push_back(style);
+    return STYLES.size() - 1;
+}
+
+static void append_number(std::string &out, int value) {
+    char digits[12];
+    int count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) out += digits[--count];
+}
 
 void set_cursor_pos(int x, int y) {
-    std::cout << "\033[" << y << ";" << x << "H";
+    std::string &out = output();
+    out += "\033[";
+    append_number(out, y);
+    out += ';';
+    append_number(out, x);
+    out += 'H';
 }
 
-void clear_screen() { std::cout << "\033[2J\033[1;1H"; }
-void enable_cursor() { std::cout << "\033[?25h"; }
-void disable_cursor() { std::cout << "\033[?25l"; }
+void clear_screen() {
+    output() += "\033[2J\033[1;1H";
+    SHOWN_VALID = false;
+}
+void enable_cursor() { output() += "\033[?25h"; }
+void disable_cursor() { output() += "\033[?25l"; }
+
+void flush_output() {
+    // A frame that changed nothing is not sent at all.
+    if (OUTPUT.size() <= sizeof(BEGIN_UPDATE) - 1) {
+        OUTPUT.clear();
+        return;
+    }
+    OUTPUT += END_UPDATE;
+    size_t sent = 0;
+    while (sent < OUTPUT.size()) {
+        ssize_t written = write(STDOUT_FILENO, OUTPUT.data() + sent,
+                                OUTPUT.size() - sent);
+        STATS.writes++;
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        sent += written;
+    }
+    STATS.flushes++;
+    STATS.bytes += sent;
+    STATS.last_bytes = sent;
+    OUTPUT.clear();
+}
 
 void get_console_size(int &width, int &height) {
     struct winsize w;
@@ -40,169 +203,289 @@ bool kbhit() {
     return false;
 }
 
-bool wait_for_input() {
-    timeval tv = {0L, 25000L};
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
-    fflush(stdout);
-    return select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0;
-}
-
-void draw_buffer(const std::vector<std::string> &buffer,
-                 const std::vector<styling> &styling) {
-    set_cursor_pos(1, 1);
-    for (size_t y = 0; y < buffer.size(); y++) {
-        bool has_style = false;
-        std::string new_buffer = buffer[y];
-        size_t offset = 0;
-        for (const auto &style : styling) {
-            if (style.y != y) continue;
-            has_style = true;
-            new_buffer.insert(style.x + offset, style.styling);
-            offset += style.styling.size();
-        }
+bool wait_for_input(int fd) {
+    flush_output();
+    return wait_for_event(fd) & EVENT_INPUT;
+}
 
-        if (!has_style) {
-            std::cout << buffer[y];
-        } else {
-            std::cout << new_buffer;
-        }
+bool fit_to_screen(frame_buffer &buffer, int &width, int &height) {
+    int screen_width, screen_height;
+    screen_size(screen_width, screen_height);
+    if (screen_width == width && screen_height == height) return false;
+    width = screen_width;
+    height = screen_height;
+    buffer.resize(width, height);
+    return true;
+}
+
+// Decodes the UTF-8 sequence at text[i] and moves i past it. A byte that does
+// not start a valid sequence comes out as U+FFFD on its own.
+static char32_t next_code_point(std::string_view text, size_t &i) {
+    unsigned char first = text[i++];
+    if (first < 0x80) return first;
+    int extra = first >= 0xF8 ? -1
+                : first >= 0xF0 ? 3
+                : first >= 0xE0 ? 2
+                : first >= 0xC0 ? 1
+                                : -1;
+    if (extra < 0 || i + extra > text.size()) return 0xFFFD;
+    char32_t point = first & (0x3F >> extra);
+    for (int k = 0; k < extra; k++) {
+        unsigned char next = text[i + k];
+        if ((next & 0xC0) != 0x80) return 0xFFFD;
+        point = point << 6 | (next & 0x3F);
     }
+    i += extra;
+    return point;
 }
 
-void clear_buffer(std::vector<std::string> &buffer, int width) {
-    for (auto &line : buffer) {
-        line = std::string(width, ' ');
+static void append_utf8(std::string &out, char32_t point) {
+    if (point < 0x80) {
+        out += static_cast<char>(point);
+    } else if (point < 0x800) {
+        out += static_cast<char>(0xC0 | point >> 6);
+        out += static_cast<char>(0x80 | (point & 0x3F));
+    } else if (point < 0x10000) {
+        out += static_cast<char>(0xE0 | point >> 12);
+        out += static_cast<char>(0x80 | (point >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (point & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | point >> 18);
+        out += static_cast<char>(0x80 | (point >> 12 & 0x3F));
+        out += static_cast<char>(0x80 | (point >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (point & 0x3F));
     }
 }
 
-void insert_into_buffer(std::vector<std::string> &buffer, int x, int y,
-                        const std::string message) {
-    for (size_t i = 0; i < message.length() && x + i < buffer[y].size(); ++i) {
-        buffer[y][x + i] = message[i];
+static void append_color(std::string &out, uint32_t color, int normal,
+                         int bright, int indexed) {
+    if (color == 0) return;
+    int index = color - 1;
+    out += ';';
+    if (index < 8) {
+        append_number(out, normal + index);
+    } else if (index < 16) {
+        append_number(out, bright + index - 8);
+    } else {
+        append_number(out, indexed);
+        out += ";5;";
+        append_number(out, index);
     }
 }
 
-void insert_colored(std::vector<std::string> &buffer,
-                    std::vector<styling> &styling, int x, int y,
-                    const std::string message, const std::string colors) {
-    insert_into_buffer(buffer, x, y, message);
-    styling.push_back({static_cast<size_t>(x), static_cast<size_t>(y), colors});
-    styling.push_back({x + message.size(), static_cast<size_t>(y), END_STYLE});
+// One sequence that resets and then sets all of style.
+static void append_style(std::string &out, uint16_t style) {
+    uint32_t packed = STYLES[style];
+    out += "\033[0";
+    for (int code = 1; code <= 9; code++) {
+        if (packed >> (ATTRIBUTE_SHIFT + code - 1) & 1) {
+            out += ';';
+            append_number(out, code);
+        }
+    }
+    append_color(out, packed & COLOR_MASK, 30, 90, 38);
+    append_color(out, packed >> BACKGROUND_SHIFT & COLOR_MASK, 40, 100, 48);
+    out += 'm';
+}
+
+// Characters this far up may take two columns, the columns after them on
+// the same line are not known.
+static bool has_wide(const cell *row, int width) {
+    return std::any_of(row, row + width,
+                       [](const cell &c) { return c.ch >= 0x1100; });
 }
 
-std::vector<styling> combine_buffers(std::vector<std::string> &main,
-                                     std::vector<std::string> &left,
-                                     std::vector<styling> &left_style,
-                                     std::vector<std::string> &right,
-                                     std::vector<styling> &right_style,
-                                     int left_width) {
-    for (size_t i = 0; i < main.size(); i++) {
-        main[i] = left[i] + "|" + right[i];
+void draw_buffer(const frame_buffer &buffer) {
+    bool full = !SHOWN_VALID || SHOWN.width() != buffer.width() ||
+                SHOWN.height() != buffer.height();
+
+    // Only the cells that changed are sent. The cursor is moved to the first
+    // of each run, unless a few unchanged cells in between are cheaper.
+    std::string &out = output();
+    if (full) out += "\033[2J";
+    size_t changed = 0;
+    int width = buffer.width();
+    int cursor_x = -1, cursor_y = -1;
+    uint16_t pen = 0;
+    auto put = [&](const cell &c) {
+        if (c.style != pen) {
+            if (c.style == 0) {
+                out += "\033[0m";
+            } else {
+                append_style(out, c.style);
+            }
+            pen = c.style;
+        }
+        append_utf8(out, c.ch);
+    };
+    for (int y = 0; y < buffer.height(); y++) {
+        const cell *row = buffer.row(y);
+        const cell *shown = full ? nullptr : SHOWN.row(y);
+        if (!full && std::equal(row, row + width, shown)) continue;
+        bool whole = full || has_wide(row, width) || has_wide(shown, width);
+        for (int x = 0; x < width; x++) {
+            const cell &now = row[x];
+            if (!whole && now == shown[x]) continue;
+            bool same_style = true;
+            for (int i = cursor_x; cursor_y == y && i < x && same_style; i++) {
+                same_style = row[i].style == pen;
+            }
+            if (cursor_y == y && x > cursor_x && x - cursor_x <= 4 &&
+                same_style) {
+                for (int i = cursor_x; i < x; i++) put(row[i]);
+            } else if (cursor_y == y && x > cursor_x) {
+                out += "\033[";
+                append_number(out, x - cursor_x);
+                out += 'C';
+            } else if (cursor_y != y || cursor_x != x) {
+                out += "\033[";
+                append_number(out, y + 1);
+                out += ';';
+                append_number(out, x + 1);
+                out += 'H';
+            }
+            put(now);
+            changed++;
+            // Past the last column the terminal waits to wrap, where the
+            // cursor ends up depends on what comes next.
+            cursor_x = x + 1;
+            cursor_y = cursor_x < width ? y : -1;
+        }
     }
+    if (pen != 0) out += "\033[0m";
+
+    SHOWN = buffer;
+    SHOWN_VALID = true;
+    STATS.frames++;
+    if (full) STATS.full_frames++;
+    STATS.cells += changed;
+}
 
-    std::vector<styling> styling = left_style;
-    for (auto &style : right_style) {
-        style.x += left_width + 1;
-        styling.push_back(style);
+const render_stats &get_render_stats() { return STATS; }
+
+void clear_buffer(frame_buffer &buffer) { buffer.clear(); }
+
+// Writes text from x on in style, up to the column limit, and returns the
+// column after it.
+static int put_text(frame_buffer &buffer, int x, int y, std::string_view text,
+                    uint16_t style, int limit) {
+    if (y < 0 || y >= buffer.height()) return x;
+    limit = std::min(limit, buffer.width());
+    for (size_t i = 0; i < text.size() && x < limit; x++) {
+        char32_t point = next_code_point(text, i);
+        if (x >= 0) buffer.at(x, y) = {point, style};
     }
+    return x;
+}
 
-    return styling;
+void insert_into_buffer(frame_buffer &buffer, int x, int y,
+                        std::string_view message) {
+    put_text(buffer, x, y, message, 0, buffer.width());
 }
 
-void add_border(std::vector<std::string> &buffer, int width) {
-    for (size_t i = 0; i < buffer.size(); i++) {
-        if (i == 0) {
-            buffer[i] = "";
-            for (int x = 0; x < width; x++) {
-                if (x == 0) {
-                    buffer[i] += "+";
-                } else if (x == width - 1) {
-                    buffer[i] += "+";
-                } else {
-                    buffer[i] += "-";
-                }
-            }
-        } else if (i == buffer.size() - 1) {
-            buffer[i] = "";
-            for (int x = 0; x < width; x++) {
-                if (x == 0) {
-                    buffer[i] += "+";
-                } else if (x == width - 1) {
-                    buffer[i] += "+";
-                } else {
-                    buffer[i] += "-";
-                }
-            }
-        } else {
-            buffer[i].replace(0, 1, "|");
-            buffer[i].replace(buffer[i].length() - 1, 1, "|");
+void insert_colored(frame_buffer &buffer, int x, int y,
+                    std::string_view message, std::string_view colors) {
+    put_text(buffer, x, y, message, style_of(colors), buffer.width());
+}
+
+void insert_highlighted(frame_buffer &buffer, int x, int y,
+                        std::string_view message,
+                        const std::vector<int> &positions,
+                        std::string_view colors, std::string_view highlight) {
+    if (y < 0 || y >= buffer.height()) return;
+    uint16_t plain = style_of(colors);
+    uint16_t marked = style_of(highlight, plain);
+    size_t next = 0;
+    for (size_t i = 0; i < message.size() && x < buffer.width(); x++) {
+        size_t offset = i;
+        char32_t point = next_code_point(message, i);
+        while (next < positions.size() &&
+               static_cast<size_t>(positions[next]) < offset) {
+            next++;
         }
+        bool hit = next < positions.size() &&
+                   static_cast<size_t>(positions[next]) == offset;
+        if (x >= 0) buffer.at(x, y) = {point, hit ? marked : plain};
     }
 }
 
-void draw_horizontal_line(std::vector<std::string> &buffer, int x1, int x2,
-                          int y, char character) {
+void insert_buffer(frame_buffer &buffer, int x, int y,
+                   const frame_buffer &from) {
+    // Only the part of from that lands inside buffer.
+    int first = std::max(0, -x);
+    int last = std::min(from.width(), buffer.width() - x);
+    if (first >= last) return;
+    for (int row = std::max(0, -y);
+         row < from.height() && y + row < buffer.height(); row++) {
+        std::copy(from.row(row) + first, from.row(row) + last,
+                  buffer.row(y + row) + x + first);
+    }
+}
+
+void combine_buffers(frame_buffer &main, const frame_buffer &left,
+                     const frame_buffer &right) {
+    main.clear();
+    insert_buffer(main, 0, 0, left);
+    for (int y = 0; y < main.height(); y++) {
+        if (main.contains(left.width(), y)) main.at(left.width(), y) = {'|', 0};
+    }
+    insert_buffer(main, left.width() + 1, 0, right);
+}
+
+void add_border(frame_buffer &buffer) {
+    int width = buffer.width(), height = buffer.height();
+    if (width == 0 || height == 0) return;
+    for (int x = 0; x < width; x++) {
+        char edge = x == 0 || x == width - 1 ? '+' : '-';
+        buffer.at(x, 0) = {static_cast<char32_t>(edge), 0};
+        buffer.at(x, height - 1) = {static_cast<char32_t>(edge), 0};
+    }
+    for (int y = 1; y < height - 1; y++) {
+        buffer.at(0, y) = {'|', 0};
+        buffer.at(width - 1, y) = {'|', 0};
+    }
+}
+
+void draw_horizontal_line(frame_buffer &buffer, int x1, int x2, int y,
+                          char character) {
     if (x1 > x2) {
         std::swap(x1, x2);
     }
 
-    if (y < 0 || static_cast<size_t>(y) >= buffer.size()) {
+    if (y < 0 || y >= buffer.height()) {
         return;
     }
 
-    for (int x = x1; x <= x2; x++) {
-        if (x >= 0 && static_cast<size_t>(x) < buffer[y].length()) {
-            buffer[y][x] = character;
-        }
+    for (int x = std::max(x1, 0); x <= x2 && x < buffer.width(); x++) {
+        buffer.at(x, y) = {static_cast<char32_t>(character), 0};
     }
 }
 
-void add_tree_to_buffer(std::vector<std::string> &buffer,
-                        std::vector<styling> &styling,
-                        const std::vector<fs::path> tree, int x, int y,
-                        int length, int highlight, int start_index) {
+void add_tree_to_buffer(frame_buffer &buffer, const file_tree &tree, int x,
+                        int y, int highlight, int start_index) {
+    // The last column is left to the border.
+    int limit = buffer.width() - 1;
     for (size_t i = start_index; i < tree.size(); i++) {
-        const fs::path path = tree[i];
-        if (static_cast<size_t>(y) == buffer.size() - 1) break;
-        if (i == static_cast<size_t>(highlight)) {
-            insert_colored(buffer, styling, x, y, path.string().substr(length),
-                           "\033[7;3m");
-        } else {
-            insert_into_buffer(buffer, x, y, path.string().substr(length));
+        if (y >= buffer.height() - 1) break;
+        const tree_row node = tree.at(i);
+        uint16_t style =
+            i == static_cast<size_t>(highlight) ? style_of("\033[7;3m") : 0;
+        int column = x;
+        for (int indent = 0; indent < node.depth * 2; indent++) {
+            column = put_text(buffer, column, y, " ", style, limit);
         }
-        y++;
-    }
-}
-
-std::vector<fs::path> file_tree(const fs::path &path) {
-    std::vector<fs::path> tree;
-    std::vector<std::string> exclude_elements = {
-        ".git", "obj", "bin", ".config", "__pycache__", "node_modules"};
-    for (const auto &entry : fs::directory_iterator(path)) {
-        bool skip = false;
-        for (const auto &excluded : exclude_elements) {
-            if (entry.path().filename().string() == excluded) {
-                skip = true;
-                break;
-            }
-        }
-
-        if (skip) continue;
-
-        if (entry.is_directory()) {
-            if (entry.path().filename().string()[0] != '.' &&
-                entry.path().filename().string()[0] != '_') {
-                tree.push_back(entry);
-                std::vector<fs::path> sub_tree = file_tree(entry.path());
-                tree.insert(tree.end(), sub_tree.begin(), sub_tree.end());
-            }
+        if (node.is_dir) {
+            column = put_text(buffer, column, y, node.expanded ? "- " : "+ ",
+                              style, limit);
+            column = put_text(buffer, column, y, node.name, style, limit);
+            column = put_text(buffer, column, y, "/", style, limit);
+            if (node.loading) put_text(buffer, column, y, " ...", style, limit);
         } else {
-            tree.push_back(entry);
+            column = put_text(buffer, column, y, "  ", style, limit);
+            put_text(buffer, column, y, node.name, style, limit);
         }
+        y++;
     }
-    return tree;
 }
 
 void set_raw_mode() {
@@ -4,48 +4,118 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include <cstdint>
 #include <filesystem>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
-#endif
+
+#include "file_tree.h"
 
 namespace fs = std::filesystem;
 
-struct styling {
-    size_t x;
-    size_t y;
-    const std::string styling;
+// A character on screen, a code point and the index of its colors and
+// attributes in the style table.
+struct cell {
+    char32_t ch = ' ';
+    uint16_t style = 0;
+
+    bool operator==(const cell &other) const {
+        return ch == other.ch && style == other.style;
+    }
+    bool operator!=(const cell &other) const { return !(*this == other); }
 };
 
+// A screen, or a part of one, as a grid of cells kept row after row in one
+// array. Writing text into it does not allocate.
+class frame_buffer {
+   public:
+    frame_buffer() = default;
+    frame_buffer(int width, int height) { resize(width, height); }
+
+    // Blank at the new size. The memory is kept when it is large enough.
+    void resize(int width, int height);
+    void clear();
+    int width() const { return columns; }
+    int height() const { return rows; }
+    bool contains(int x, int y) const {
+        return x >= 0 && y >= 0 && x < columns && y < rows;
+    }
+    cell &at(int x, int y) { return cells[y * columns + x]; }
+    const cell &at(int x, int y) const { return cells[y * columns + x]; }
+    // The width cells of row y.
+    cell *row(int y) { return cells.data() + y * columns; }
+    const cell *row(int y) const { return cells.data() + y * columns; }
+
+   private:
+    int columns = 0;
+    int rows = 0;
+    std::vector<cell> cells;
+};
+
+// What has been sent to the terminal so far.
+struct render_stats {
+    size_t frames = 0;
+    size_t full_frames = 0;  // drawn from scratch, after a clear or resize
+    size_t cells = 0;        // that changed and were sent
+    size_t flushes = 0;
+    size_t writes = 0;  // write calls, more than flushes on partial writes
+    size_t bytes = 0;
+    size_t last_bytes = 0;  // of the latest flush
+};
+
+// The style applying the SGR sequences in colors, in order, on top of base.
+// Styles are kept packed, colors and attributes in one word, and only new
+// ones are added to the table.
+uint16_t style_of(std::string_view colors, uint16_t base = 0);
+
+// These and draw_buffer only add to the pending output, which goes to the
+// terminal in one write on flush_output or wait_for_input.
 void set_cursor_pos(int x, int y);
+// Clears the terminal, the next draw_buffer sends the whole buffer again.
 void clear_screen();
 void enable_cursor();
 void disable_cursor();
+void flush_output();
 void get_console_size(int &width, int &height);
-bool wait_for_input();
+// Flushes the output and waits until there is a key to read, returning true,
+// or until something else changed and the screen should be drawn again. fd,
+// when given, also counts as a change once readable.
+bool wait_for_input(int fd = -1);
+// Resizes buffer, blank, to the terminal when its size is no longer width
+// and height, which are updated. Returns whether it did.
+bool fit_to_screen(frame_buffer &buffer, int &width, int &height);
 bool kbhit();
-void draw_buffer(const std::vector<std::string> &buffer,
-                 const std::vector<styling> &styling);
-void clear_buffer(std::vector<std::string> &buffer, int width);
-void insert_into_buffer(std::vector<std::string> &buffer, int x, int y,
-                        const std::string message);
-void insert_colored(std::vector<std::string> &buffer,
-                    std::vector<styling> &styling, int x, int y,
-                    const std::string message, const std::string colors);
-std::vector<styling> combine_buffers(std::vector<std::string> &main,
-                                     std::vector<std::string> &left,
-                                     std::vector<styling> &left_style,
-                                     std::vector<std::string> &right,
-                                     std::vector<styling> &right_style,
-                                     int left_width);
-void add_border(std::vector<std::string> &buffer, int width);
-void draw_horizontal_line(std::vector<std::string> &buffer, int x1, int x2,
-                          int y, char character);
-void add_tree_to_buffer(std::vector<std::string> &buffer,
-                        std::vector<styling> &styling,
-                        const std::vector<fs::path> tree, int x, int y,
-                        int length, int highlight, int start_index);
-std::vector<fs::path> file_tree(const fs::path &path);
+// Adds what differs from the previous call to the output, runs of changed
+// cells with the cursor moves and styles they need.
+void draw_buffer(const frame_buffer &buffer);
+const render_stats &get_render_stats();
+void clear_buffer(frame_buffer &buffer);
+// Text is UTF-8, one cell per code point. What does not fit is cut off.
+void insert_into_buffer(frame_buffer &buffer, int x, int y,
+                        std::string_view message);
+void insert_colored(frame_buffer &buffer, int x, int y,
+                    std::string_view message, std::string_view colors);
+// Like insert_colored, with the characters starting at the byte offsets in
+// positions, in increasing order, drawn with highlight added.
+void insert_highlighted(frame_buffer &buffer, int x, int y,
+                        std::string_view message,
+                        const std::vector<int> &positions,
+                        std::string_view colors, std::string_view highlight);
+// Copies from into buffer with its top left corner at x, y.
+void insert_buffer(frame_buffer &buffer, int x, int y,
+                   const frame_buffer &from);
+// Fills main with left and right next to each other, a '|' between them.
+void combine_buffers(frame_buffer &main, const frame_buffer &left,
+                     const frame_buffer &right);
+void add_border(frame_buffer &buffer);
+void draw_horizontal_line(frame_buffer &buffer, int x1, int x2, int y,
+                          char character);
+// Draws the rows of tree from start_index on, indented by depth, with the
+// directories marked + when collapsed and - when expanded.
+void add_tree_to_buffer(frame_buffer &buffer, const file_tree &tree, int x,
+                        int y, int highlight, int start_index);
 void set_raw_mode();
 void reset_raw_mode();
+#endif
@@ -0,0 +1,260 @@
+#include "watcher.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "tree_walker.h"
+
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+// Directories added to the watch set per loop iteration, so events keep
+// being handled while a large tree is still being watched.
+static const size_t WATCH_BATCH = 64;
+// How long new directories wait before they are scanned.
+static const auto SCAN_DELAY = std::chrono::milliseconds(200);
+
+static bool is_below(const std::string &path, const std::string &dir) {
+    return path.size() > dir.size() && path[dir.size()] == '/' &&
+           path.compare(0, dir.size(), dir) == 0;
+}
+
+// PROJECTS_MAX_WATCHES caps the watch set, by default it takes at most a
+// quarter of the per user inotify limit so other programs keep theirs.
+static size_t watch_limit() {
+    size_t limit = 8192;
+    const char *env = std::getenv("PROJECTS_MAX_WATCHES");
+    if (env != nullptr) limit = std::strtoul(env, nullptr, 10);
+
+    std::ifstream file("/proc/sys/fs/inotify/max_user_watches");
+    size_t system_limit;
+    if (file >> system_limit) limit = std::min(limit, system_limit / 4);
+    return limit;
+}
+
+project_watcher::project_watcher(const std::string &root,
+                                 const discovery_options &options,
+                                 project_model &model)
+    : root(root), options(options), model(model), max_watches(watch_limit()) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd < 0 || stop_fd < 0) return;
+
+    to_watch.push_back(root);
+    thread = std::thread(&project_watcher::run, this);
+}
+
+project_watcher::~project_watcher() {
+    if (thread.joinable()) {
+        uint64_t one = 1;
+        write(stop_fd, &one, sizeof(one));
+        thread.join();
+    }
+    if (inotify_fd >= 0) close(inotify_fd);
+    if (stop_fd >= 0) close(stop_fd);
+}
+
+void project_watcher::run() {
+    pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    while (true) {
+        int timeout = -1;
+        if (!to_watch.empty()) {
+            timeout = 0;
+        } else if (!to_scan.empty()) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                scan_at - std::chrono::steady_clock::now());
+            timeout = std::max<int>(left.count(), 0);
+        }
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) return;
+        if (fds[1].revents & POLLIN) return;
+        if (fds[0].revents & POLLIN) handle_events();
+        if (!to_scan.empty() && std::chrono::steady_clock::now() >= scan_at) {
+            scan_pending();
+        }
+        watch_next();
+    }
+}
+
+void project_watcher::watch_next() {
+    for (size_t n = 0; n < WATCH_BATCH && !to_watch.empty(); n++) {
+        if (watches.size() >= max_watches) {
+            to_watch.clear();
+            return;
+        }
+
+        const std::string dir = to_watch.front();
+        to_watch.pop_front();
+
+        int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) continue;
+
+        std::vector<std::string> children;
+        bool is_repo = false;
+        dir_reader reader(dir_fd);
+        const char *name;
+        unsigned char type;
+        while (reader.next(name, type)) {
+            if (strcmp(name, ".git") == 0) {
+                is_repo = true;
+                continue;
+            }
+            if (std::find(options.prune.begin(), options.prune.end(), name) !=
+                options.prune.end()) {
+                continue;
+            }
+            // Some file systems report DT_UNKNOWN, entry_type stats those.
+            if (entry_type(dir_fd, name, type, false) != node_type::directory) {
+                continue;
+            }
+            children.push_back(dir + "/" + name);
+        }
+        close(dir_fd);
+
+        // A repository can show up between the scan of a new directory and
+        // the moment it gets watched. Known ones are ignored by the model.
+        if (is_repo && dir != root) {
+            model.push({project_event_type::added, dir, ""});
+            if (!options.nested_repos) continue;
+        }
+
+        int wd = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            if (errno == ENOSPC) to_watch.clear();
+            continue;
+        }
+        watches[wd] = dir;
+        if (is_repo && !options.nested_repos) continue;
+        to_watch.insert(to_watch.end(), children.begin(), children.end());
+    }
+}
+
+void project_watcher::handle_events() {
+    alignas(inotify_event) char
+        buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+    ssize_t length;
+    while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + length;) {
+            const inotify_event *event =
+                reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                scan(root);
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches.erase(event->wd);
+                continue;
+            }
+
+            auto it = watches.find(event->wd);
+            if (it == watches.end() || event->len == 0) continue;
+            const std::string dir = it->second;
+            const std::string name = event->name;
+            const std::string path = dir + "/" + name;
+
+            if (name == ".git") {
+                // The directory itself became a repository, or stopped
+                // being one.
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    model.push({project_event_type::added, dir, ""});
+                    if (!options.nested_repos && dir != root) unwatch(dir);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    model.push({project_event_type::removed, dir, ""});
+                }
+                continue;
+            }
+
+            if (!(event->mask & IN_ISDIR)) continue;
+            if (std::find(options.prune.begin(), options.prune.end(), name) !=
+                options.prune.end()) {
+                continue;
+            }
+
+            if (event->mask & IN_MOVED_FROM) {
+                moves[event->cookie] = path;
+            } else if (event->mask & IN_MOVED_TO) {
+                auto move = moves.find(event->cookie);
+                if (move != moves.end()) {
+                    model.push(
+                        {project_event_type::renamed, move->second, path});
+                    rewatch(move->second, path);
+                    moves.erase(move);
+                } else {
+                    scan(path);
+                }
+            } else if (event->mask & IN_CREATE) {
+                scan(path);
+            } else if (event->mask & IN_DELETE) {
+                model.push({project_event_type::removed, path, ""});
+            }
+        }
+    }
+
+    // Directories moved out of the tree never get a matching IN_MOVED_TO.
+    for (const auto &[cookie, path] : moves) {
+        model.push({project_event_type::removed, path, ""});
+        unwatch(path);
+    }
+    moves.clear();
+}
+
+void project_watcher::rewatch(const std::string &from, const std::string &to) {
+    for (auto &[wd, path] : watches) {
+        if (path == from || is_below(path, from)) {
+            path = to + path.substr(from.size());
+        }
+    }
+}
+
+void project_watcher::unwatch(const std::string &dir) {
+    for (const auto &[wd, path] : watches) {
+        if (path == dir || is_below(path, dir)) {
+            inotify_rm_watch(inotify_fd, wd);
+        }
+    }
+}
+
+// Queues a directory that appeared to be scanned shortly.
+void project_watcher::scan(const std::string &dir) {
+    if (to_scan.empty()) {
+        scan_at = std::chrono::steady_clock::now() + SCAN_DELAY;
+    }
+    to_scan.push_back(dir);
+}
+
+// Reports the repositories below the directories that appeared and queues
+// them to be watched. Directories below another one in the batch are covered
+// by it. The walk runs on this thread, new directories are mostly small.
+void project_watcher::scan_pending() {
+    // Shorter paths first, so a directory comes before those below it.
+    std::sort(to_scan.begin(), to_scan.end(),
+              [](const std::string &a, const std::string &b) {
+                  return a.size() < b.size();
+              });
+    discovery_options single = options;
+    single.threads = 1;
+    std::vector<std::string> scanned;
+    for (const std::string &dir : to_scan) {
+        if (std::any_of(scanned.begin(), scanned.end(),
+                        [&](const std::string &other) {
+                            return dir == other || is_below(dir, other);
+                        })) {
+            continue;
+        }
+        scanned.push_back(dir);
+        discover_projects(dir, single, [&](const std::string &path) {
+            model.push({project_event_type::added, path, ""});
+        });
+        to_watch.push_back(dir);
+    }
+    to_scan.clear();
+}
@@ -0,0 +1,48 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "discovery.h"
+#include "project_model.h"
+
+// Keeps the project model current while pm is running. Directories below the
+// root are watched with inotify, shallow ones first and only up to a bound, so
+// a large tree does not run into max_user_watches. Repositories themselves are
+// not watched, their parent directory reports them coming and going.
+class project_watcher {
+   public:
+    project_watcher(const std::string &root, const discovery_options &options,
+                    project_model &model);
+    ~project_watcher();
+
+   private:
+    const std::string root;
+    const discovery_options options;
+    project_model &model;
+
+    int inotify_fd = -1;
+    int stop_fd = -1;
+    size_t max_watches;
+    std::unordered_map<int, std::string> watches;
+    std::deque<std::string> to_watch;
+    std::unordered_map<uint32_t, std::string> moves;
+    // New directories wait here a moment, so a burst of them, from a clone
+    // or a mkdir -p, is scanned once.
+    std::vector<std::string> to_scan;
+    std::chrono::steady_clock::time_point scan_at;
+    std::thread thread;
+
+    void run();
+    void watch_next();
+    void handle_events();
+    void rewatch(const std::string &from, const std::string &to);
+    void unwatch(const std::string &dir);
+    void scan(const std::string &dir);
+    void scan_pending();
+};
+#endif